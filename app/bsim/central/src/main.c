@@ -0,0 +1,378 @@
+/**
+ * @file main.c
+ *
+ * Simulated central for the app's BLE service on nrf52_bsim. Connects to the first device
+ * advertising the service, subscribes to all three characteristics and checks what the
+ * peripheral does with the link: the 247 byte MTU, the data length and 2M PHY updates it asks
+ * for on connect, decoded characters batched into one notification per message, and the
+ * state and LED notifications. The peripheral is the app itself, typing
+ * CONFIG_APP_SIM_STIMULUS_TEXT through its stimulus thread.
+ */
+
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/sys/printk.h>
+
+#include "bs_types.h"
+#include "bs_tracing.h"
+#include "bstests.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define CENTRAL_WAIT_TIME       (30 * 1000 * 1000) // Simulated us before a test that hasn't passed fails
+#define CENTRAL_POLL_MS         100
+#define CENTRAL_MTU             247
+#define CENTRAL_DATA_LEN        251
+#define CENTRAL_MESSAGE         "Hi" // The peripheral's CONFIG_APP_SIM_STIMULUS_TEXT
+#define CENTRAL_MESSAGES        3 // Decoded messages to receive before passing
+#define CENTRAL_NUM_LEDS        4
+
+#define BLE_UUID_SERVICE_VAL    BT_UUID_128_ENCODE(0x8e1e0000, 0x6d3b, 0x4c4e, 0xa1e5, 0x2f0e4ee52840)
+#define BLE_UUID_CHARS_VAL      BT_UUID_128_ENCODE(0x8e1e0001, 0x6d3b, 0x4c4e, 0xa1e5, 0x2f0e4ee52840)
+#define BLE_UUID_STATE_VAL      BT_UUID_128_ENCODE(0x8e1e0002, 0x6d3b, 0x4c4e, 0xa1e5, 0x2f0e4ee52840)
+#define BLE_UUID_LEDS_VAL       BT_UUID_128_ENCODE(0x8e1e0003, 0x6d3b, 0x4c4e, 0xa1e5, 0x2f0e4ee52840)
+
+#define FAIL(...) \
+  do { \
+    bst_result = Failed; \
+    bs_trace_error_time_line(__VA_ARGS__); \
+  } while (0)
+
+#define PASS(...) \
+  do { \
+    bst_result = Passed; \
+    bs_trace_info_time(1, __VA_ARGS__); \
+  } while (0)
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+typedef enum central_char_t {
+  CENTRAL_CHARS = 0,
+  CENTRAL_STATE,
+  CENTRAL_LEDS,
+  NUM_CENTRAL_CHARS,
+} central_char;
+
+/*
+ * Written from the BT host callbacks, polled by the test thread
+ */
+typedef struct central_t {
+  struct bt_conn *conn;
+  struct bt_gatt_discover_params discover;
+  struct bt_gatt_subscribe_params subscribe[NUM_CENTRAL_CHARS];
+  atomic_t found; // Bit per central_char whose value handle is known
+  atomic_t data_len_ok;
+  atomic_t phy_2m;
+  atomic_t messages; // Character notifications that carried a whole message
+  atomic_t split; // Character notifications that carried less than a whole message
+  atomic_t states;
+  atomic_t leds;
+} central;
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static bool _central_ad_has_service(struct bt_data *data, void *user_data);
+
+static void _central_device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type, struct net_buf_simple *ad);
+
+static uint8_t _central_notified(struct bt_conn *conn, struct bt_gatt_subscribe_params *params, const void *data, uint16_t length);
+
+static uint8_t _central_discovered(struct bt_conn *conn, const struct bt_gatt_attr *attr, struct bt_gatt_discover_params *params);
+
+static void _central_connected(struct bt_conn *conn, uint8_t err);
+
+static void _central_disconnected(struct bt_conn *conn, uint8_t reason);
+
+static void _central_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *info);
+
+static void _central_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *info);
+
+static bool _central_done();
+
+static void _central_init();
+
+static void _central_tick(bs_time_t time);
+
+static void _central_main();
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+extern enum bst_result_t bst_result;
+
+static const uint8_t _central_service[] = {BLE_UUID_SERVICE_VAL};
+
+static const struct bt_uuid_128 _central_uuids[NUM_CENTRAL_CHARS] = {
+  [CENTRAL_CHARS] = BT_UUID_INIT_128(BLE_UUID_CHARS_VAL),
+  [CENTRAL_STATE] = BT_UUID_INIT_128(BLE_UUID_STATE_VAL),
+  [CENTRAL_LEDS] = BT_UUID_INIT_128(BLE_UUID_LEDS_VAL),
+};
+
+static central _central = {.conn=NULL};
+
+BT_CONN_CB_DEFINE(_central_conn_callbacks) = {
+  .connected = _central_connected,
+  .disconnected = _central_disconnected,
+  .le_data_len_updated = _central_data_len_updated,
+  .le_phy_updated = _central_phy_updated,
+};
+
+static const struct bst_test_instance _central_tests[] = {
+  {
+    .test_id = "central",
+    .test_descr = "Connect to the app, check the link updates and the batched notifications",
+    .test_pre_init_f = _central_init,
+    .test_tick_f = _central_tick,
+    .test_main_f = _central_main,
+  },
+  BSTEST_END_MARKER
+};
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Looks for the app's service UUID in an advertising report
+ *
+ * @param [in] data One AD structure of the report
+ * @param [out] user_data bool set to true once the UUID is found
+ *
+ * @return false to stop parsing
+ */
+static bool _central_ad_has_service(struct bt_data *data, void *user_data) {
+  bool *found = user_data;
+
+  if (BT_DATA_UUID128_ALL == data->type && sizeof(_central_service) == data->data_len
+      && 0 == memcmp(data->data, _central_service, sizeof(_central_service))) {
+    *found = true;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Connects to the first connectable device that advertises the service
+ */
+static void _central_device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type, struct net_buf_simple *ad) {
+  bool found = false;
+
+  if (_central.conn || BT_GAP_ADV_TYPE_ADV_IND != type) {
+    return;
+  }
+
+  bt_data_parse(ad, _central_ad_has_service, &found);
+  if (!found) {
+    return;
+  }
+
+  bt_le_scan_stop();
+  int rv = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, BT_LE_CONN_PARAM_DEFAULT, &_central.conn);
+  if (rv < 0) {
+    FAIL("central: connect failed (%d)\n", rv);
+  }
+}
+
+/**
+ * @brief Checks and counts every notification. A decoded message has to arrive whole, the
+ *        peripheral batches its characters instead of notifying them one by one
+ */
+static uint8_t _central_notified(struct bt_conn *conn, struct bt_gatt_subscribe_params *params, const void *data, uint16_t length) {
+  if (!data) {
+    return BT_GATT_ITER_STOP;
+  }
+
+  switch (params - _central.subscribe) {
+    case CENTRAL_CHARS:
+      if (sizeof(CENTRAL_MESSAGE) - 1 == length && 0 == memcmp(data, CENTRAL_MESSAGE, length)) {
+        atomic_inc(&_central.messages);
+      } else {
+        printk("central: %u characters in one notification\n", length);
+        atomic_inc(&_central.split);
+      }
+      break;
+    case CENTRAL_STATE:
+      atomic_inc(&_central.states);
+      break;
+    case CENTRAL_LEDS:
+      if (CENTRAL_NUM_LEDS != length) {
+        FAIL("central: %u LEDs notified, expected %u\n", length, CENTRAL_NUM_LEDS);
+      }
+      atomic_inc(&_central.leds);
+      break;
+    default:
+      break;
+  }
+  return BT_GATT_ITER_CONTINUE;
+}
+
+/**
+ * @brief Subscribes to each of the service's characteristics as discovery finds them. The
+ *        service declares every CCC right after its value attribute
+ */
+static uint8_t _central_discovered(struct bt_conn *conn, const struct bt_gatt_attr *attr, struct bt_gatt_discover_params *params) {
+  if (!attr) {
+    if (BIT_MASK(NUM_CENTRAL_CHARS) != atomic_get(&_central.found)) {
+      FAIL("central: found only 0x%lx of the characteristics\n", (unsigned long)atomic_get(&_central.found));
+    }
+    return BT_GATT_ITER_STOP;
+  }
+
+  const struct bt_gatt_chrc *chrc = attr->user_data;
+  for (int i = 0; i < NUM_CENTRAL_CHARS; i++) {
+    if (0 != bt_uuid_cmp(chrc->uuid, &_central_uuids[i].uuid)) {
+      continue;
+    }
+
+    struct bt_gatt_subscribe_params *subscribe = &_central.subscribe[i];
+    subscribe->notify = _central_notified;
+    subscribe->value = BT_GATT_CCC_NOTIFY;
+    subscribe->value_handle = chrc->value_handle;
+    subscribe->ccc_handle = chrc->value_handle + 1;
+    int rv = bt_gatt_subscribe(conn, subscribe);
+    if (rv < 0) {
+      FAIL("central: subscribe %d failed (%d)\n", i, rv);
+    }
+    atomic_set_bit(&_central.found, i);
+  }
+  return BT_GATT_ITER_CONTINUE;
+}
+
+/**
+ * @brief Discovers the characteristics once connected, the peripheral starts the link
+ *        updates on its own
+ */
+static void _central_connected(struct bt_conn *conn, uint8_t err) {
+  if (err) {
+    FAIL("central: connection failed (0x%02x)\n", err);
+    return;
+  }
+
+  _central.discover.uuid = NULL;
+  _central.discover.func = _central_discovered;
+  _central.discover.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+  _central.discover.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+  _central.discover.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+  int rv = bt_gatt_discover(conn, &_central.discover);
+  if (rv < 0) {
+    FAIL("central: discovery failed (%d)\n", rv);
+  }
+}
+
+/**
+ * @brief The peripheral never disconnects on its own
+ */
+static void _central_disconnected(struct bt_conn *conn, uint8_t reason) {
+  FAIL("central: disconnected (0x%02x)\n", reason);
+}
+
+/**
+ * @brief Checks the data length the peripheral asked for was granted both ways
+ */
+static void _central_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *info) {
+  printk("central: data length tx %u rx %u\n", info->tx_max_len, info->rx_max_len);
+  atomic_set(&_central.data_len_ok, CENTRAL_DATA_LEN == info->tx_max_len && CENTRAL_DATA_LEN == info->rx_max_len);
+}
+
+/**
+ * @brief Checks the peripheral moved the link to the 2M PHY both ways
+ */
+static void _central_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *info) {
+  printk("central: phy tx %u rx %u\n", info->tx_phy, info->rx_phy);
+  atomic_set(&_central.phy_2m, BT_GAP_LE_PHY_2M == info->tx_phy && BT_GAP_LE_PHY_2M == info->rx_phy);
+}
+
+/**
+ * @brief Checks if everything the test waits for has arrived
+ *
+ * @return true once it has
+ */
+static bool _central_done() {
+  return atomic_get(&_central.data_len_ok) && atomic_get(&_central.phy_2m)
+    && atomic_get(&_central.messages) >= CENTRAL_MESSAGES && atomic_get(&_central.states)
+    && atomic_get(&_central.leds);
+}
+
+/**
+ * @brief Fails the test if it hasn't passed within CENTRAL_WAIT_TIME
+ */
+static void _central_init() {
+  bst_ticker_set_next_tick_absolute(CENTRAL_WAIT_TIME);
+  bst_result = In_progress;
+}
+
+/**
+ * @brief Runs at CENTRAL_WAIT_TIME
+ *
+ * @param [in] time Unused, the simulated time
+ */
+static void _central_tick(bs_time_t time __attribute__((unused))) {
+  if (Passed != bst_result) {
+    FAIL("central: not passed after %d s\n", CENTRAL_WAIT_TIME / 1000000);
+  }
+}
+
+/**
+ * @brief Scans for the app and waits for every check to pass
+ */
+static void _central_main() {
+  int rv = bt_enable(NULL);
+  if (rv < 0) {
+    FAIL("central: bt_enable failed (%d)\n", rv);
+    return;
+  }
+
+  rv = bt_le_scan_start(BT_LE_SCAN_PASSIVE, _central_device_found);
+  if (rv < 0) {
+    FAIL("central: scan failed (%d)\n", rv);
+    return;
+  }
+
+  while (!_central_done()) {
+    k_msleep(CENTRAL_POLL_MS);
+  }
+
+  uint16_t mtu = bt_gatt_get_mtu(_central.conn);
+  if (CENTRAL_MTU != mtu) {
+    FAIL("central: MTU %u, expected %u\n", mtu, CENTRAL_MTU);
+    return;
+  }
+  if (atomic_get(&_central.split)) {
+    FAIL("central: %ld messages were split over notifications\n", (long)atomic_get(&_central.split));
+    return;
+  }
+
+  printk("central: %ld messages, %ld states, %ld LED updates\n", (long)atomic_get(&_central.messages),
+    (long)atomic_get(&_central.states), (long)atomic_get(&_central.leds));
+  PASS("central: PASS\n");
+}
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Adds the central's test to the bsim test list, picked with -testid=central
+ *
+ * @param [in] tests The list so far
+ *
+ * @return The list with the central's test added
+ */
+struct bst_test_list *central_tests_install(struct bst_test_list *tests) {
+  return bst_add_tests(tests, _central_tests);
+}
+
+bst_test_install_t test_installers[] = {
+  central_tests_install,
+  NULL
+};
+
+int main(void) {
+  bst_main();
+  return 0;
+}
@@ -0,0 +1,325 @@
+/**
+ * @file main.c
+ *
+ * Simulated scanner for the app's periodic advertising broadcast on nrf52_bsim. Syncs to the
+ * first train advertised under the app's name and measures, for every new sequence number,
+ * how long the update took to arrive: simulated boards share one clock, so the time stamp
+ * the app puts in the payload (CONFIG_APP_BLE_BROADCAST_STAMP) is subtracted from the
+ * scanner's own uptime. Any number of scanners can follow the same train, each reports its
+ * own latencies.
+ */
+
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+
+#include "bs_types.h"
+#include "bs_tracing.h"
+#include "bstests.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define SCANNER_WAIT_TIME       (30 * 1000 * 1000) // Simulated us before a test that hasn't passed fails
+#define SCANNER_POLL_MS         100
+#define SCANNER_NAME            "EiE BLE Peripheral" // The app's CONFIG_BT_DEVICE_NAME
+#define SCANNER_COMPANY         0xFFFF // The app's CONFIG_APP_BLE_BROADCAST_COMPANY_ID
+#define SCANNER_INTERVAL_US     (100 * 1000) // The app's CONFIG_APP_BLE_BROADCAST_INTERVAL_MS
+#define SCANNER_MAX_LATENCY_US  (2 * SCANNER_INTERVAL_US) // One interval, and one lost packet
+#define SCANNER_UPDATES         50 // New sequence numbers to receive before passing
+#define SCANNER_SYNC_TIMEOUT    100 // 10 ms units
+
+// Offsets in the app's ble_broadcast_payload
+#define SCANNER_OFF_COMPANY     0
+#define SCANNER_OFF_SEQ         2
+#define SCANNER_OFF_STAMP       3
+#define SCANNER_MIN_LEN         7
+
+#define FAIL(...) \
+  do { \
+    bst_result = Failed; \
+    bs_trace_error_time_line(__VA_ARGS__); \
+  } while (0)
+
+#define PASS(...) \
+  do { \
+    bst_result = Passed; \
+    bs_trace_info_time(1, __VA_ARGS__); \
+  } while (0)
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+/*
+ * The fields of the app's payload the scanner uses
+ */
+typedef struct scanner_payload_t {
+  bool found;
+  uint8_t seq;
+  uint32_t stamp_us;
+} scanner_payload;
+
+/*
+ * Written from the BT host callbacks, read by the test thread once done
+ */
+typedef struct scanner_t {
+  struct bt_le_per_adv_sync *sync;
+  atomic_t done; // Set before the test deletes the sync
+  bool have_seq;
+  uint8_t seq;
+  atomic_t updates; // New sequence numbers received
+  uint32_t skipped; // Sequence numbers never seen, replaced before they went on air
+  uint32_t max_us;
+  uint64_t total_us;
+} scanner;
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static bool _scanner_ad_has_name(struct bt_data *data, void *user_data);
+
+static bool _scanner_ad_payload(struct bt_data *data, void *user_data);
+
+static void _scanner_recv(const struct bt_le_scan_recv_info *info, struct net_buf_simple *buf);
+
+static void _scanner_synced(struct bt_le_per_adv_sync *sync, struct bt_le_per_adv_sync_synced_info *info);
+
+static void _scanner_term(struct bt_le_per_adv_sync *sync, const struct bt_le_per_adv_sync_term_info *info);
+
+static void _scanner_per_recv(struct bt_le_per_adv_sync *sync, const struct bt_le_per_adv_sync_recv_info *info, struct net_buf_simple *buf);
+
+static void _scanner_init();
+
+static void _scanner_tick(bs_time_t time);
+
+static void _scanner_main();
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+extern enum bst_result_t bst_result;
+
+static scanner _scanner = {.sync=NULL};
+
+static struct bt_le_scan_cb _scanner_scan_cb = {
+  .recv = _scanner_recv,
+};
+
+static struct bt_le_per_adv_sync_cb _scanner_sync_cb = {
+  .synced = _scanner_synced,
+  .term = _scanner_term,
+  .recv = _scanner_per_recv,
+};
+
+static const struct bst_test_instance _scanner_tests[] = {
+  {
+    .test_id = "scanner",
+    .test_descr = "Sync to the app's broadcast and measure the update latency",
+    .test_pre_init_f = _scanner_init,
+    .test_tick_f = _scanner_tick,
+    .test_main_f = _scanner_main,
+  },
+  BSTEST_END_MARKER
+};
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Looks for the app's name in an advertising report
+ *
+ * @param [in] data One AD structure of the report
+ * @param [out] user_data bool set to true once the name is found
+ *
+ * @return false to stop parsing
+ */
+static bool _scanner_ad_has_name(struct bt_data *data, void *user_data) {
+  bool *found = user_data;
+
+  if (BT_DATA_NAME_COMPLETE == data->type && sizeof(SCANNER_NAME) - 1 == data->data_len
+      && 0 == memcmp(data->data, SCANNER_NAME, data->data_len)) {
+    *found = true;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Finds the app's manufacturer specific data in a periodic advertising report
+ *
+ * @param [in] data One AD structure of the report
+ * @param [out] user_data scanner_payload filled in once found
+ *
+ * @return false to stop parsing
+ */
+static bool _scanner_ad_payload(struct bt_data *data, void *user_data) {
+  scanner_payload *payload = user_data;
+
+  if (BT_DATA_MANUFACTURER_DATA == data->type && data->data_len >= SCANNER_MIN_LEN
+      && SCANNER_COMPANY == sys_get_le16(&data->data[SCANNER_OFF_COMPANY])) {
+    payload->found = true;
+    payload->seq = data->data[SCANNER_OFF_SEQ];
+    payload->stamp_us = sys_get_le32(&data->data[SCANNER_OFF_STAMP]);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Syncs to the first periodic train advertised under the app's name
+ */
+static void _scanner_recv(const struct bt_le_scan_recv_info *info, struct net_buf_simple *buf) {
+  bool found = false;
+
+  if (_scanner.sync || 0 == info->interval) {
+    return;
+  }
+
+  bt_data_parse(buf, _scanner_ad_has_name, &found);
+  if (!found) {
+    return;
+  }
+
+  struct bt_le_per_adv_sync_param param = {
+    .sid = info->sid,
+    .skip = 0,
+    .timeout = SCANNER_SYNC_TIMEOUT,
+  };
+  bt_addr_le_copy(&param.addr, info->addr);
+
+  int rv = bt_le_per_adv_sync_create(&param, &_scanner.sync);
+  if (rv < 0) {
+    FAIL("scanner: sync failed (%d)\n", rv);
+  }
+}
+
+/**
+ * @brief Stops scanning once synced, the train carries everything from here on
+ */
+static void _scanner_synced(struct bt_le_per_adv_sync *sync, struct bt_le_per_adv_sync_synced_info *info) {
+  printk("scanner: synced, interval %u us\n", info->interval * 1250);
+  bt_le_scan_stop();
+}
+
+/**
+ * @brief The app never stops its train, only the test ends the sync
+ */
+static void _scanner_term(struct bt_le_per_adv_sync *sync, const struct bt_le_per_adv_sync_term_info *info) {
+  if (atomic_get(&_scanner.done)) {
+    return;
+  }
+  FAIL("scanner: sync lost (0x%02x)\n", info->reason);
+}
+
+/**
+ * @brief Times every new sequence number against the stamp of the change. Repeats of the
+ *        last payload are ignored
+ */
+static void _scanner_per_recv(struct bt_le_per_adv_sync *sync, const struct bt_le_per_adv_sync_recv_info *info, struct net_buf_simple *buf) {
+  uint32_t now_us = k_ticks_to_us_floor32(k_uptime_ticks());
+  scanner_payload payload = {.found=false};
+
+  bt_data_parse(buf, _scanner_ad_payload, &payload);
+  if (!payload.found) {
+    return;
+  }
+
+  uint8_t seq = payload.seq;
+  if (_scanner.have_seq && seq == _scanner.seq) {
+    return;
+  }
+
+  // The first payload may have been on air since before the sync, only time the changes
+  if (_scanner.have_seq) {
+    uint32_t latency_us = now_us - payload.stamp_us;
+
+    _scanner.skipped += (uint8_t)(seq - _scanner.seq - 1);
+    _scanner.max_us = MAX(_scanner.max_us, latency_us);
+    _scanner.total_us += latency_us;
+    atomic_inc(&_scanner.updates);
+  }
+  _scanner.have_seq = true;
+  _scanner.seq = seq;
+}
+
+/**
+ * @brief Fails the test if it hasn't passed within SCANNER_WAIT_TIME
+ */
+static void _scanner_init() {
+  bst_ticker_set_next_tick_absolute(SCANNER_WAIT_TIME);
+  bst_result = In_progress;
+}
+
+/**
+ * @brief Runs at SCANNER_WAIT_TIME
+ *
+ * @param [in] time Unused, the simulated time
+ */
+static void _scanner_tick(bs_time_t time __attribute__((unused))) {
+  if (Passed != bst_result) {
+    FAIL("scanner: not passed after %d s\n", SCANNER_WAIT_TIME / 1000000);
+  }
+}
+
+/**
+ * @brief Scans for the app's train and waits for SCANNER_UPDATES updates
+ */
+static void _scanner_main() {
+  int rv = bt_enable(NULL);
+  if (rv < 0) {
+    FAIL("scanner: bt_enable failed (%d)\n", rv);
+    return;
+  }
+
+  bt_le_scan_cb_register(&_scanner_scan_cb);
+  bt_le_per_adv_sync_cb_register(&_scanner_sync_cb);
+
+  rv = bt_le_scan_start(BT_LE_SCAN_PASSIVE, NULL);
+  if (rv < 0) {
+    FAIL("scanner: scan failed (%d)\n", rv);
+    return;
+  }
+
+  while (atomic_get(&_scanner.updates) < SCANNER_UPDATES) {
+    k_msleep(SCANNER_POLL_MS);
+  }
+
+  // Stop the callbacks before reading what they wrote
+  atomic_set(&_scanner.done, 1);
+  bt_le_per_adv_sync_delete(_scanner.sync);
+
+  uint32_t updates = atomic_get(&_scanner.updates);
+  printk("scanner: %u updates, %u replaced before going on air, latency avg %u us max %u us\n",
+    updates, _scanner.skipped, (uint32_t)(_scanner.total_us / updates), _scanner.max_us);
+  if (_scanner.max_us > SCANNER_MAX_LATENCY_US) {
+    FAIL("scanner: latency %u us over %u us\n", _scanner.max_us, SCANNER_MAX_LATENCY_US);
+    return;
+  }
+  PASS("scanner: PASS\n");
+}
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Adds the scanner's test to the bsim test list, picked with -testid=scanner
+ *
+ * @param [in] tests The list so far
+ *
+ * @return The list with the scanner's test added
+ */
+struct bst_test_list *scanner_tests_install(struct bst_test_list *tests) {
+  return bst_add_tests(tests, _scanner_tests);
+}
+
+bst_test_install_t test_installers[] = {
+  scanner_tests_install,
+  NULL
+};
+
+int main(void) {
+  bst_main();
+  return 0;
+}
@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+# Copyright (c) 2021 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+#
+# Runs the app broadcasting its state, typing CONFIG_APP_SIM_STIMULUS_TEXT through its
+# stimulus thread, with two simulated scanners from app/bsim/scanner synced to the same
+# periodic train. Each scanner prints the update latency it measured and fails the run if an
+# update took longer than two advertising intervals to reach it.
+#
+# Build the images with Twister first, it copies them into ${BSIM_OUT_PATH}/bin:
+#
+#     west twister -T app -p nrf52_bsim -s app.ble.broadcast.bsim -s app.ble.broadcast.bsim.scanner
+#     app/bsim/tests_scripts/ble_broadcast.sh
+
+source ${ZEPHYR_BASE}/tests/bsim/sh_common.source
+
+simulation_id="app_ble_broadcast"
+verbosity_level=2
+
+cd ${BSIM_OUT_PATH}/bin
+
+Execute ./bs_${BOARD_TS}_app_ble_broadcast \
+  -v=${verbosity_level} -s=${simulation_id} -d=0 -RealEncryption=0
+
+Execute ./bs_${BOARD_TS}_app_ble_scanner \
+  -v=${verbosity_level} -s=${simulation_id} -d=1 -RealEncryption=0 -testid=scanner
+
+Execute ./bs_${BOARD_TS}_app_ble_scanner \
+  -v=${verbosity_level} -s=${simulation_id} -d=2 -RealEncryption=0 -testid=scanner
+
+Execute ./bs_2G4_phy_v1 -v=${verbosity_level} -s=${simulation_id} \
+  -D=3 -sim_length=40e6 $@
+
+wait_for_background_jobs
@@ -0,0 +1,30 @@
+#!/usr/bin/env bash
+# Copyright (c) 2021 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+#
+# Runs the app as a BLE peripheral, typing CONFIG_APP_SIM_STIMULUS_TEXT through its stimulus
+# thread, against the simulated central in app/bsim/central. The central fails the run unless
+# it sees the MTU, data length and 2M PHY updates and the batched notifications.
+#
+# Build both images with Twister first, it copies them into ${BSIM_OUT_PATH}/bin:
+#
+#     west twister -T app -p nrf52_bsim -s app.ble.bsim -s app.ble.bsim.central
+#     app/bsim/tests_scripts/ble_central.sh
+
+source ${ZEPHYR_BASE}/tests/bsim/sh_common.source
+
+simulation_id="app_ble_central"
+verbosity_level=2
+
+cd ${BSIM_OUT_PATH}/bin
+
+Execute ./bs_${BOARD_TS}_app_ble_peripheral \
+  -v=${verbosity_level} -s=${simulation_id} -d=0 -RealEncryption=0
+
+Execute ./bs_${BOARD_TS}_app_ble_central \
+  -v=${verbosity_level} -s=${simulation_id} -d=1 -RealEncryption=0 -testid=central
+
+Execute ./bs_2G4_phy_v1 -v=${verbosity_level} -s=${simulation_id} \
+  -D=2 -sim_length=40e6 $@
+
+wait_for_background_jobs
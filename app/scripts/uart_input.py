@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+"""
+Load test the password state machine through CONFIG_APP_UART_INPUT.
+
+Sends random messages as tap frames, the same taps a user makes on the board: the bits of
+the first character on BTN0/BTN1, BTN3, the bits of the rest, BTN3 twice to decode, BTN2 to
+start over. Every decoded message that comes back is checked against what was sent, and the
+message and tap rates are printed at the end.
+
+On native_sim the input UART is the second pty, printed at startup as
+"uart_1 connected to pseudotty: /dev/pts/N":
+
+    ./build/zephyr/zephyr.exe &
+    app/scripts/uart_input.py /dev/pts/N --messages 5000
+
+The board must be freshly booted, so the state machine starts in ENTRYA.
+"""
+
+import argparse
+import os
+import random
+import selectors
+import sys
+import termios
+import time
+import tty
+
+SOF = 0x7E
+MAX_TAPS = 255
+BTN0, BTN1, BTN2, BTN3 = range(4)
+
+
+def frame(length, payload):
+    checksum = length
+    for byte in payload:
+        checksum ^= byte
+    return bytes([SOF, length]) + bytes(payload) + bytes([checksum])
+
+
+def encode_taps(taps):
+    """Packs taps 2 bits each, 4 per byte from the low bits, in frames of up to 255 taps."""
+    out = bytearray()
+    for start in range(0, len(taps), MAX_TAPS):
+        chunk = taps[start:start + MAX_TAPS]
+        payload = bytearray((len(chunk) + 3) // 4)
+        for i, btn in enumerate(chunk):
+            payload[i // 4] |= btn << ((i % 4) * 2)
+        out += frame(len(chunk), payload)
+    return bytes(out)
+
+
+def message_taps(message):
+    def char_taps(c):
+        return [BTN1 if c & (1 << bit) else BTN0 for bit in range(7, -1, -1)]
+
+    taps = char_taps(message[0]) + [BTN3]
+    for c in message[1:]:
+        taps += char_taps(c)
+    return taps + [BTN3, BTN3, BTN2]
+
+
+class ReplyParser:
+    """Collects the message frames sent back by the board, dropping any that are corrupt."""
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.bad = 0
+
+    def feed(self, data):
+        self.buf += data
+        replies = []
+        while True:
+            start = self.buf.find(SOF)
+            if start < 0:
+                self.buf.clear()
+                return replies
+            del self.buf[:start]
+            if len(self.buf) < 2 or len(self.buf) < self.buf[1] + 3:
+                return replies
+            length = self.buf[1]
+            payload = bytes(self.buf[2:2 + length])
+            checksum = length
+            for byte in payload:
+                checksum ^= byte
+            if checksum == self.buf[2 + length]:
+                replies.append(payload)
+                del self.buf[:length + 3]
+            else:
+                self.bad += 1
+                del self.buf[:1]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="input UART of the board, e.g. a native_sim pty")
+    parser.add_argument("--messages", type=int, default=1000, help="messages to send")
+    parser.add_argument("--chars", type=int, default=2, help="characters per message, CONFIG_APP_MSG_CHARS")
+    parser.add_argument("--seed", type=int, default=None, help="seed for the random messages")
+    parser.add_argument("--timeout", type=float, default=10.0, help="seconds to wait without a reply")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    messages = [bytes(rng.randrange(0x20, 0x7F) for _ in range(args.chars)) for _ in range(args.messages)]
+    taps = [tap for message in messages for tap in message_taps(message)]
+    tx = encode_taps(taps)
+
+    fd = os.open(args.port, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+    tty.setraw(fd)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+
+    sel = selectors.DefaultSelector()
+    sel.register(fd, selectors.EVENT_READ | selectors.EVENT_WRITE)
+    replies = ReplyParser()
+    received = 0
+    mismatches = 0
+    sent = 0
+    start = time.monotonic()
+    last_rx = start
+
+    # Blast every frame while reading replies, so neither side of the pty fills up
+    while received < len(messages):
+        if time.monotonic() - last_rx > args.timeout:
+            print(f"timeout: {received} of {len(messages)} messages back", file=sys.stderr)
+            break
+        for _, events in sel.select(timeout=0.1):
+            if events & selectors.EVENT_WRITE and sent < len(tx):
+                sent += os.write(fd, tx[sent:sent + 4096])
+                if sent == len(tx):
+                    sel.modify(fd, selectors.EVENT_READ)
+            if events & selectors.EVENT_READ:
+                for reply in replies.feed(os.read(fd, 4096)):
+                    if received < len(messages) and reply != messages[received]:
+                        mismatches += 1
+                        print(f"message {received}: sent {messages[received]!r}, got {reply!r}", file=sys.stderr)
+                    received += 1
+                    last_rx = time.monotonic()
+
+    elapsed = last_rx - start
+    os.close(fd)
+    print(f"{received}/{len(messages)} messages, {mismatches} mismatched, {replies.bad} corrupt replies")
+    if elapsed > 0:
+        print(f"{received / elapsed:.1f} messages/s, {len(taps) * received / len(messages) / elapsed:.1f} taps/s "
+              f"({2 * len(taps) * received / len(messages) / elapsed:.1f} button events/s)")
+    return 0 if received == len(messages) and mismatches == 0 else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
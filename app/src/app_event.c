@@ -0,0 +1,106 @@
+/**
+ * @file app_event.c
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <inttypes.h>
+
+#include "app_event.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define APP_EVENT_STATS_WINDOW_MS   1000
+
+LOG_MODULE_DECLARE(app, CONFIG_APP_LOG_LEVEL);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+K_MSGQ_DEFINE(_app_event_queue, sizeof(app_event), CONFIG_APP_EVENT_QUEUE_SIZE, 1);
+
+static uint32_t _wakeup_count = 0;
+static int64_t _wakeup_window_start = 0;
+static uint32_t _wakeups_per_second = 0;
+
+static uint32_t _latency_count = 0;
+static uint32_t _latency_max_us = 0;
+static uint64_t _latency_sum_us = 0;
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Posts an event to the application queue, safe to call from an ISR
+ *
+ * @param [in] type The kind of event being posted
+ * @param [in] data Event specific payload
+ *
+ * @return Error code, < 0 on failures (-ENOMSG if the queue is full)
+ */
+int app_event_post(app_event_type type, uint8_t data) {
+  app_event evt = {.type=type, .data=data};
+  return k_msgq_put(&_app_event_queue, &evt, K_NO_WAIT);
+}
+
+/**
+ * @brief Blocks until an event is posted or the timeout expires
+ *
+ * @param [out] evt Filled with the received event
+ * @param [in] timeout How long to wait, K_FOREVER to sleep until the next event
+ *
+ * @return 0 if an event was received, -EAGAIN on timeout
+ */
+int app_event_wait(app_event *evt, k_timeout_t timeout) {
+  return k_msgq_get(&_app_event_queue, evt, timeout);
+}
+
+/**
+ * @brief Records one wakeup of the main loop and updates the wakeup rate once per window
+ */
+void app_event_count_wakeup() {
+  int64_t now = k_uptime_get();
+  int64_t elapsed = now - _wakeup_window_start;
+
+  _wakeup_count++;
+  if (elapsed < APP_EVENT_STATS_WINDOW_MS) {
+    return;
+  }
+
+  // Windows stretch while idle, so scale back to a per second rate
+  _wakeups_per_second = (uint32_t)((_wakeup_count * 1000LL) / elapsed);
+  _wakeup_count = 0;
+  _wakeup_window_start = now;
+
+  if (IS_ENABLED(CONFIG_APP_WAKEUP_STATS)) {
+    LOG_INF("wakeups/s: %" PRIu32, _wakeups_per_second);
+  }
+}
+
+/**
+ * @brief Gets the main loop wakeup rate measured over the last completed window
+ *
+ * @return Wakeups per second
+ */
+uint32_t app_event_wakeups_per_second() {
+  return _wakeups_per_second;
+}
+
+/**
+ * @brief Records how long it took from a button edge until the state machine finished reacting to it
+ *
+ * @param [in] edge_timestamp k_cycle_get_32() at the button edge, as carried by btn_event
+ */
+void app_event_count_latency(uint32_t edge_timestamp) {
+  uint32_t latency_us = k_cyc_to_us_floor32(k_cycle_get_32() - edge_timestamp);
+
+  _latency_count++;
+  _latency_sum_us += latency_us;
+  _latency_max_us = MAX(_latency_max_us, latency_us);
+
+  if (IS_ENABLED(CONFIG_APP_LATENCY_STATS)) {
+    LOG_INF("press latency: %" PRIu32 " us (max %" PRIu32 " us, avg %" PRIu32 " us)",
+      latency_us, _latency_max_us, (uint32_t)(_latency_sum_us / _latency_count));
+  }
+}
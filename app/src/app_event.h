@@ -0,0 +1,39 @@
+/**
+ * @file app_event.h
+ */
+
+#ifndef APP_EVENT_H
+#define APP_EVENT_H
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/* ----------------------------------------------------------------------------
+                                    TYPES
+---------------------------------------------------------------------------- */
+typedef enum app_event_type_t {
+  APP_EVENT_BTN = 0,
+  APP_EVENT_DRIVER,
+  APP_EVENT_GESTURE,
+  APP_EVENT_DEFERRED,
+} app_event_type;
+
+typedef struct app_event_t {
+  uint8_t type; // One of app_event_type
+  uint8_t data; // Event specific payload, e.g. the btn_id for APP_EVENT_BTN
+} app_event;
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+int app_event_post(app_event_type type, uint8_t data);
+
+int app_event_wait(app_event *evt, k_timeout_t timeout);
+
+void app_event_count_wakeup();
+
+uint32_t app_event_wakeups_per_second();
+
+void app_event_count_latency(uint32_t edge_timestamp);
+
+#endif // APP_EVENT_H
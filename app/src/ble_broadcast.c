@@ -0,0 +1,192 @@
+/**
+ * @file ble_broadcast.c
+ *
+ * Non-connectable extended advertising set with a periodic advertising train. The extended
+ * advertisements carry the device name and point scanners at the train, the train carries
+ * manufacturer specific data with the state, the message length and its last characters.
+ * Scanners sync to the train once and then receive every update without scanning or
+ * connecting, however many of them there are.
+ *
+ * The payload is rebuilt after every state machine run but only handed to the controller
+ * when it differs from the one on air, and each change bumps a sequence number so a scanner
+ * can tell new data from a repeat. With CONFIG_APP_BLE_BROADCAST_STAMP the payload also
+ * carries the uptime of the change, so a scanner sharing the clock, as simulated boards do,
+ * can time how long each update took to reach it.
+ */
+
+#include <zephyr/kernel.h>
+#include <stddef.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "ble_broadcast.h"
+#include "msg_entry.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define BLE_BROADCAST_CHARS     CONFIG_APP_BLE_BROADCAST_CHARS
+#define BLE_BROADCAST_INTERVAL  ((CONFIG_APP_BLE_BROADCAST_INTERVAL_MS * 4) / 5) // 1.25 ms units
+#define BLE_BROADCAST_COMPANY   CONFIG_APP_BLE_BROADCAST_COMPANY_ID
+
+LOG_MODULE_DECLARE(app, CONFIG_APP_LOG_LEVEL);
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+/*
+ * Manufacturer specific data, everything after seq is what gets compared for changes
+ */
+typedef struct __packed ble_broadcast_payload_t {
+  uint8_t company[2]; // Little endian company identifier
+  uint8_t seq; // Incremented on every change
+#ifdef CONFIG_APP_BLE_BROADCAST_STAMP
+  uint8_t stamp[4]; // Little endian uptime of the change in us
+#endif
+  uint8_t state; // State machine state index
+  uint8_t chars; // Completed characters in the message
+  uint8_t bits; // Bits entered of the character in progress
+  uint8_t last[BLE_BROADCAST_CHARS]; // Most recent characters, oldest first, 0 padded
+} ble_broadcast_payload;
+
+/*
+ * Built from the main thread, handed to the controller from the system workqueue
+ */
+typedef struct ble_broadcast_t {
+  struct k_spinlock lock;
+  struct bt_le_ext_adv *adv;
+  ble_broadcast_payload payload;
+  struct k_work update;
+} ble_broadcast;
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static void _ble_broadcast_send(struct k_work *work);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_BT_CTLR_ADV_DATA_LEN_MAX
+// The payload plus its AD length and type bytes has to fit the controller's advertising data
+BUILD_ASSERT(sizeof(ble_broadcast_payload) + 2 <= CONFIG_BT_CTLR_ADV_DATA_LEN_MAX,
+  "APP_BLE_BROADCAST_CHARS needs a larger CONFIG_BT_CTLR_ADV_DATA_LEN_MAX");
+#endif
+
+static const struct bt_data _ble_broadcast_ad[] = {
+  BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME, sizeof(CONFIG_BT_DEVICE_NAME) - 1),
+};
+
+static ble_broadcast _ble_broadcast = {
+  .adv=NULL,
+  .payload={.company={BLE_BROADCAST_COMPANY & 0xFF, BLE_BROADCAST_COMPANY >> 8}},
+};
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Puts the latest payload on the periodic train. Updates that arrive while this runs
+ *        resubmit the work, so the last one always goes out
+ *
+ * @param [in] work Unused, the update work item
+ */
+static void _ble_broadcast_send(struct k_work *work __attribute__((unused))) {
+  ble_broadcast_payload payload;
+
+  K_SPINLOCK(&_ble_broadcast.lock) {
+    payload = _ble_broadcast.payload;
+  }
+
+  const struct bt_data ad[] = {
+    BT_DATA(BT_DATA_MANUFACTURER_DATA, &payload, sizeof(payload)),
+  };
+
+  int rv = bt_le_per_adv_set_data(_ble_broadcast.adv, ad, ARRAY_SIZE(ad));
+  if (rv < 0) {
+    LOG_WRN("BLE broadcast update failed (%d)", rv);
+  }
+}
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Creates the advertising set and starts the periodic train with the current payload.
+ *        Needs the BLE stack to be enabled
+ *
+ * @return Error code, < 0 on failures
+ */
+int ble_broadcast_start() {
+  k_work_init(&_ble_broadcast.update, _ble_broadcast_send);
+
+  int rv = bt_le_ext_adv_create(BT_LE_EXT_ADV_NCONN, NULL, &_ble_broadcast.adv);
+  if (rv < 0) {
+    LOG_ERR("BLE broadcast set failed (%d)", rv);
+    return rv;
+  }
+
+  rv = bt_le_ext_adv_set_data(_ble_broadcast.adv, _ble_broadcast_ad, ARRAY_SIZE(_ble_broadcast_ad), NULL, 0);
+  if (rv < 0) {
+    return rv;
+  }
+
+  rv = bt_le_per_adv_set_param(_ble_broadcast.adv,
+    BT_LE_PER_ADV_PARAM(BLE_BROADCAST_INTERVAL, BLE_BROADCAST_INTERVAL, BT_LE_PER_ADV_OPT_NONE));
+  if (rv < 0) {
+    return rv;
+  }
+
+  _ble_broadcast_send(NULL);
+
+  rv = bt_le_per_adv_start(_ble_broadcast.adv);
+  if (rv < 0) {
+    return rv;
+  }
+
+  rv = bt_le_ext_adv_start(_ble_broadcast.adv, BT_LE_EXT_ADV_START_DEFAULT);
+  if (rv < 0) {
+    LOG_ERR("BLE broadcast failed (%d)", rv);
+  }
+  return rv;
+}
+
+/**
+ * @brief Rebuilds the payload from the state and the message engine, and queues it for the
+ *        controller if anything changed. Cheap enough to call after every state machine run
+ *
+ * @param [in] state The state the machine is in
+ */
+void ble_broadcast_update(uint8_t state) {
+  ble_broadcast_payload next = {
+    .state=state,
+    .chars=MIN(msg_entry_len(), UINT8_MAX),
+    .bits=msg_entry_partial_bits(),
+  };
+  uint16_t len = msg_entry_len();
+  uint16_t first = len > BLE_BROADCAST_CHARS ? len - BLE_BROADCAST_CHARS : 0;
+
+  for (uint16_t i = first; i < len; i++) {
+    next.last[i - first] = msg_entry_peek(i);
+  }
+
+  const size_t offset = offsetof(ble_broadcast_payload, state);
+  if (0 == memcmp((uint8_t *)&next + offset, (uint8_t *)&_ble_broadcast.payload + offset, sizeof(next) - offset)) {
+    return;
+  }
+
+  K_SPINLOCK(&_ble_broadcast.lock) {
+    memcpy((uint8_t *)&_ble_broadcast.payload + offset, (uint8_t *)&next + offset, sizeof(next) - offset);
+    _ble_broadcast.payload.seq++;
+#ifdef CONFIG_APP_BLE_BROADCAST_STAMP
+    sys_put_le32(k_ticks_to_us_floor32(k_uptime_ticks()), _ble_broadcast.payload.stamp);
+#endif
+  }
+
+  // Until the stack is up the payload is only kept, ble_broadcast_start sends the latest one
+  if (_ble_broadcast.adv) {
+    k_work_submit(&_ble_broadcast.update);
+  }
+}
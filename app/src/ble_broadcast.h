@@ -0,0 +1,31 @@
+/**
+ * @file ble_broadcast.h
+ *
+ * Publishes the state machine state and the message being entered in periodic advertising,
+ * so any number of scanners can follow the board without connecting. Compiles to nothing
+ * unless CONFIG_APP_BLE_BROADCAST is enabled.
+ */
+
+#ifndef BLE_BROADCAST_H
+#define BLE_BROADCAST_H
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_APP_BLE_BROADCAST
+
+int ble_broadcast_start();
+
+void ble_broadcast_update(uint8_t state);
+
+#else
+
+static inline int ble_broadcast_start() { return 0; }
+
+static inline void ble_broadcast_update(uint8_t state) {}
+
+#endif // CONFIG_APP_BLE_BROADCAST
+
+#endif // BLE_BROADCAST_H
@@ -0,0 +1,436 @@
+/**
+ * @file ble_service.c
+ *
+ * Custom GATT service with three notify characteristics: the characters decoded in END,
+ * the current state machine state, and the duty cycle of every LED. Updates are collected
+ * for CONFIG_APP_BLE_BATCH_MS and sent together from the system workqueue, characters in
+ * MTU sized notifications and state/LEDs only as their latest value, so a burst of changes
+ * costs a few packets in one connection event instead of one notification each.
+ */
+
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/logging/log.h>
+
+#include "LED.h"
+#include "ble_broadcast.h"
+#include "ble_service.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define BLE_ATT_HEADER_SIZE     3 // Opcode and handle in front of every notification
+#define BLE_CHAR_BATCH_MAX      (CONFIG_BT_L2CAP_TX_MTU - BLE_ATT_HEADER_SIZE)
+#define BLE_CONN_INTERVAL       ((CONFIG_APP_BLE_CONN_INTERVAL_MS * 4) / 5) // 1.25 ms units
+#define BLE_SUPERVISION_TIMEOUT 400 // 10 ms units
+
+#define BLE_UUID_SERVICE_VAL    BT_UUID_128_ENCODE(0x8e1e0000, 0x6d3b, 0x4c4e, 0xa1e5, 0x2f0e4ee52840)
+#define BLE_UUID_CHARS_VAL      BT_UUID_128_ENCODE(0x8e1e0001, 0x6d3b, 0x4c4e, 0xa1e5, 0x2f0e4ee52840)
+#define BLE_UUID_STATE_VAL      BT_UUID_128_ENCODE(0x8e1e0002, 0x6d3b, 0x4c4e, 0xa1e5, 0x2f0e4ee52840)
+#define BLE_UUID_LEDS_VAL       BT_UUID_128_ENCODE(0x8e1e0003, 0x6d3b, 0x4c4e, 0xa1e5, 0x2f0e4ee52840)
+
+// Value attribute of each characteristic in the service, each follows its declaration
+#define BLE_ATTR_CHARS          2
+#define BLE_ATTR_STATE          5
+#define BLE_ATTR_LEDS           8
+
+LOG_MODULE_DECLARE(app, CONFIG_APP_LOG_LEVEL);
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+/*
+ * Filled from the main thread, drained from the system workqueue. Everything but leds and
+ * flush is guarded by lock, leds is only touched on the workqueue. lock also guards _ble_conn
+ */
+typedef struct ble_batch_t {
+  struct k_spinlock lock;
+  uint8_t chars[BLE_CHAR_BATCH_MAX];
+  uint16_t char_count;
+  uint8_t state;
+  bool state_dirty;
+  uint8_t leds[NUM_LEDS]; // Duty cycles last notified
+  struct k_work_delayable flush;
+} ble_batch;
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static ssize_t _ble_read_state(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, uint16_t len, uint16_t offset);
+
+static ssize_t _ble_read_leds(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, uint16_t len, uint16_t offset);
+
+static void _ble_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value);
+
+static struct bt_conn *_ble_conn_get();
+
+static bool _ble_subscribed(struct bt_conn *conn, uint8_t attr);
+
+static void _ble_flush(struct k_work *work);
+
+static void _ble_connected(struct bt_conn *conn, uint8_t err);
+
+static void _ble_disconnected(struct bt_conn *conn, uint8_t reason);
+
+static void _ble_recycled();
+
+static int _ble_advertise();
+
+static void _ble_ready(int err);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+BT_GATT_SERVICE_DEFINE(_ble_service,
+  BT_GATT_PRIMARY_SERVICE(BT_UUID_DECLARE_128(BLE_UUID_SERVICE_VAL)),
+  BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(BLE_UUID_CHARS_VAL), BT_GATT_CHRC_NOTIFY,
+    BT_GATT_PERM_NONE, NULL, NULL, NULL),
+  BT_GATT_CCC(_ble_ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+  BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(BLE_UUID_STATE_VAL), BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+    BT_GATT_PERM_READ, _ble_read_state, NULL, NULL),
+  BT_GATT_CCC(_ble_ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+  BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(BLE_UUID_LEDS_VAL), BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+    BT_GATT_PERM_READ, _ble_read_leds, NULL, NULL),
+  BT_GATT_CCC(_ble_ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+);
+
+BT_CONN_CB_DEFINE(_ble_conn_callbacks) = {
+  .connected = _ble_connected,
+  .disconnected = _ble_disconnected,
+  .recycled = _ble_recycled,
+};
+
+static const struct bt_data _ble_ad[] = {
+  BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+  BT_DATA_BYTES(BT_DATA_UUID128_ALL, BLE_UUID_SERVICE_VAL),
+};
+
+static const struct bt_data _ble_sd[] = {
+  BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME, sizeof(CONFIG_BT_DEVICE_NAME) - 1),
+};
+
+static struct bt_conn *_ble_conn = NULL; // Set and cleared by the connection callbacks under _ble_batch.lock
+
+static ble_batch _ble_batch = {.char_count=0, .state_dirty=false};
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Reads the current state machine state
+ *
+ * @return Bytes read, or a negative ATT error
+ */
+static ssize_t _ble_read_state(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, uint16_t len, uint16_t offset) {
+  uint8_t state;
+
+  K_SPINLOCK(&_ble_batch.lock) {
+    state = _ble_batch.state;
+  }
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, &state, sizeof(state));
+}
+
+/**
+ * @brief Reads the duty cycle of every LED, one byte per LED
+ *
+ * @return Bytes read, or a negative ATT error
+ */
+static ssize_t _ble_read_leds(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, uint16_t len, uint16_t offset) {
+  uint8_t leds[NUM_LEDS];
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    leds[i] = LED_get_pwm(i);
+  }
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, leds, sizeof(leds));
+}
+
+/**
+ * @brief Starts the batch timer when a central subscribes, so the LEDs get polled from then on
+ *
+ * @param [in] attr The CCC descriptor that was written
+ * @param [in] value The new CCC value
+ */
+static void _ble_ccc_changed(const struct bt_gatt_attr *attr __attribute__((unused)), uint16_t value) {
+  if (value) {
+    k_work_schedule(&_ble_batch.flush, K_MSEC(CONFIG_APP_BLE_BATCH_MS));
+  }
+}
+
+/**
+ * @brief Takes a reference on the current connection, so it stays valid however long the caller
+ *        uses it, even if the central disconnects meanwhile
+ *
+ * @return The connection, to be released with bt_conn_unref, or NULL if there is none
+ */
+static struct bt_conn *_ble_conn_get() {
+  struct bt_conn *conn = NULL;
+
+  K_SPINLOCK(&_ble_batch.lock) {
+    if (_ble_conn) {
+      conn = bt_conn_ref(_ble_conn);
+    }
+  }
+  return conn;
+}
+
+/**
+ * @brief Checks if the central wants notifications for a characteristic
+ *
+ * @param [in] conn The connection, from _ble_conn_get
+ * @param [in] attr Index of the characteristic's value attribute in the service
+ *
+ * @return true if notifications are enabled
+ */
+static bool _ble_subscribed(struct bt_conn *conn, uint8_t attr) {
+  return bt_gatt_is_subscribed(conn, &_ble_service.attrs[attr], BT_GATT_CCC_NOTIFY);
+}
+
+/**
+ * @brief Sends everything collected since the last flush. Characters go out in MTU sized
+ *        notifications, state and LEDs only if they changed. Whatever can't be sent for lack of
+ *        buffers stays queued for the next flush. Re-arms itself while anything is left, and
+ *        while the LEDs are subscribed since they change on their own (blinks, fades)
+ *
+ * @param [in] work Unused, the batch timer's work item
+ */
+static void _ble_flush(struct k_work *work __attribute__((unused))) {
+  struct bt_conn *conn = _ble_conn_get();
+
+  if (!conn) {
+    return;
+  }
+
+  if (_ble_subscribed(conn, BLE_ATTR_CHARS)) {
+    uint16_t mtu = bt_gatt_get_mtu(conn) - BLE_ATT_HEADER_SIZE;
+    uint16_t sent = 0;
+    uint8_t chunk[BLE_CHAR_BATCH_MAX];
+    uint16_t count;
+
+    K_SPINLOCK(&_ble_batch.lock) {
+      count = _ble_batch.char_count;
+      memcpy(chunk, _ble_batch.chars, count);
+    }
+
+    while (sent < count) {
+      uint16_t len = MIN(count - sent, mtu);
+      if (0 != bt_gatt_notify(conn, &_ble_service.attrs[BLE_ATTR_CHARS], &chunk[sent], len)) {
+        break;
+      }
+      sent += len;
+    }
+
+    // Characters may have been added while sending, keep those
+    K_SPINLOCK(&_ble_batch.lock) {
+      memmove(_ble_batch.chars, &_ble_batch.chars[sent], _ble_batch.char_count - sent);
+      _ble_batch.char_count -= sent;
+    }
+  } else {
+    K_SPINLOCK(&_ble_batch.lock) {
+      _ble_batch.char_count = 0;
+    }
+  }
+
+  uint8_t state;
+  bool state_dirty;
+  K_SPINLOCK(&_ble_batch.lock) {
+    state = _ble_batch.state;
+    state_dirty = _ble_batch.state_dirty;
+  }
+
+  // Nobody to tell counts as sent, a later subscriber reads the state instead. A state that
+  // changed again while notifying stays dirty for the next flush
+  if (state_dirty && (!_ble_subscribed(conn, BLE_ATTR_STATE)
+      || 0 == bt_gatt_notify(conn, &_ble_service.attrs[BLE_ATTR_STATE], &state, sizeof(state)))) {
+    K_SPINLOCK(&_ble_batch.lock) {
+      _ble_batch.state_dirty = (_ble_batch.state != state);
+    }
+  }
+
+  bool leds_subscribed = _ble_subscribed(conn, BLE_ATTR_LEDS);
+  if (leds_subscribed) {
+    uint8_t leds[NUM_LEDS];
+
+    for (int i = 0; i < NUM_LEDS; i++) {
+      leds[i] = LED_get_pwm(i);
+    }
+    if (0 != memcmp(leds, _ble_batch.leds, sizeof(leds))
+        && 0 == bt_gatt_notify(conn, &_ble_service.attrs[BLE_ATTR_LEDS], leds, sizeof(leds))) {
+      memcpy(_ble_batch.leds, leds, sizeof(leds));
+    }
+  }
+
+  bool pending;
+  K_SPINLOCK(&_ble_batch.lock) {
+    // A disconnect while sending has already dropped the batch, don't re-arm for it
+    pending = _ble_conn && (_ble_batch.char_count || _ble_batch.state_dirty || leds_subscribed);
+  }
+  if (pending) {
+    k_work_schedule(&_ble_batch.flush, K_MSEC(CONFIG_APP_BLE_BATCH_MS));
+  }
+  bt_conn_unref(conn);
+}
+
+/**
+ * @brief Asks for the configured connection interval, the largest data length and the 2M PHY.
+ *        The controller falls back on its own if the central doesn't support them
+ *
+ * @param [in] conn The new connection
+ * @param [in] err HCI error, 0 on success
+ */
+static void _ble_connected(struct bt_conn *conn, uint8_t err) {
+  if (err) {
+    LOG_WRN("BLE connection failed (0x%02x)", err);
+    return;
+  }
+
+  memset(_ble_batch.leds, 0xFF, sizeof(_ble_batch.leds)); // Send the LEDs once on subscribe
+  K_SPINLOCK(&_ble_batch.lock) {
+    _ble_conn = bt_conn_ref(conn);
+  }
+
+  bt_conn_le_param_update(conn, BT_LE_CONN_PARAM(BLE_CONN_INTERVAL, BLE_CONN_INTERVAL, 0, BLE_SUPERVISION_TIMEOUT));
+  if (IS_ENABLED(CONFIG_BT_USER_DATA_LEN_UPDATE)) {
+    bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+  }
+  if (IS_ENABLED(CONFIG_BT_USER_PHY_UPDATE)) {
+    bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+  }
+}
+
+/**
+ * @brief Drops the connection and anything still waiting to be sent. A flush already running
+ *        holds its own reference, the cancel waits for it to finish before the last one goes
+ *
+ * @param [in] conn The connection that ended
+ * @param [in] reason HCI reason for the disconnect
+ */
+static void _ble_disconnected(struct bt_conn *conn, uint8_t reason) {
+  bool ours = false;
+
+  K_SPINLOCK(&_ble_batch.lock) {
+    if (conn == _ble_conn) {
+      ours = true;
+      _ble_conn = NULL;
+      _ble_batch.char_count = 0;
+    }
+  }
+  if (!ours) {
+    return;
+  }
+
+  struct k_work_sync sync;
+  k_work_cancel_delayable_sync(&_ble_batch.flush, &sync);
+  bt_conn_unref(conn);
+}
+
+/**
+ * @brief Advertises again once the previous connection object has been freed
+ */
+static void _ble_recycled() {
+  _ble_advertise();
+}
+
+/**
+ * @brief Starts connectable advertising with the service UUID
+ *
+ * @return Error code, < 0 on failures
+ */
+static int _ble_advertise() {
+  int rv = bt_le_adv_start(BT_LE_ADV_CONN_FAST_1, _ble_ad, ARRAY_SIZE(_ble_ad), _ble_sd, ARRAY_SIZE(_ble_sd));
+  if (rv < 0 && -EALREADY != rv) {
+    LOG_ERR("BLE advertising failed (%d)", rv);
+    return rv;
+  }
+  return 0;
+}
+
+/**
+ * @brief Starts advertising once the controller is up, runs on the system workqueue
+ *
+ * @param [in] err Result of the stack init, < 0 on failures
+ */
+static void _ble_ready(int err) {
+  if (err < 0) {
+    LOG_ERR("BLE init failed (%d)", err);
+    return;
+  }
+
+  // A failed broadcast leaves the service usable
+  ble_broadcast_start();
+  _ble_advertise();
+}
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Enables the BLE stack in the background, the service and the state broadcast (when
+ *        enabled) start advertising once the controller is up. Bringing the controller up
+ *        takes a while, so main doesn't wait for it before taking input
+ *
+ * @return Error code, < 0 if the stack couldn't be started
+ */
+int ble_service_init() {
+  k_work_init_delayable(&_ble_batch.flush, _ble_flush);
+
+  int rv = bt_enable(_ble_ready);
+  if (rv < 0) {
+    LOG_ERR("BLE init failed (%d)", rv);
+  }
+  return rv;
+}
+
+/**
+ * @brief Queues a decoded character for the next batch. Characters are dropped while nobody
+ *        is connected, or if a full batch is still waiting for buffers
+ *
+ * @param [in] c The character
+ */
+void ble_service_char(uint8_t c) {
+  bool connected = false;
+  bool full = false;
+
+  K_SPINLOCK(&_ble_batch.lock) {
+    connected = (NULL != _ble_conn);
+    if (!connected) {
+      K_SPINLOCK_BREAK;
+    }
+    if (_ble_batch.char_count < BLE_CHAR_BATCH_MAX) {
+      _ble_batch.chars[_ble_batch.char_count++] = c;
+    }
+    full = (_ble_batch.char_count == BLE_CHAR_BATCH_MAX);
+  }
+  if (!connected) {
+    return;
+  }
+
+  // A full batch goes out now, otherwise wait for more to join it
+  if (full) {
+    k_work_reschedule(&_ble_batch.flush, K_NO_WAIT);
+  } else {
+    k_work_schedule(&_ble_batch.flush, K_MSEC(CONFIG_APP_BLE_BATCH_MS));
+  }
+}
+
+/**
+ * @brief Records a state change, only the latest state of a batch is notified
+ *
+ * @param [in] state The state the machine moved to
+ */
+void ble_service_state(uint8_t state) {
+  bool connected;
+
+  K_SPINLOCK(&_ble_batch.lock) {
+    _ble_batch.state = state;
+    _ble_batch.state_dirty = true;
+    connected = (NULL != _ble_conn);
+  }
+
+  if (connected) {
+    k_work_schedule(&_ble_batch.flush, K_MSEC(CONFIG_APP_BLE_BATCH_MS));
+  }
+}
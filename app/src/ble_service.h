@@ -0,0 +1,34 @@
+/**
+ * @file ble_service.h
+ *
+ * Custom GATT service that streams decoded characters, the state machine state and the
+ * LED duty cycles to a connected central. Compiles to nothing unless CONFIG_APP_BLE is enabled.
+ */
+
+#ifndef BLE_SERVICE_H
+#define BLE_SERVICE_H
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_APP_BLE
+
+int ble_service_init();
+
+void ble_service_char(uint8_t c);
+
+void ble_service_state(uint8_t state);
+
+#else
+
+static inline int ble_service_init() { return 0; }
+
+static inline void ble_service_char(uint8_t c) {}
+
+static inline void ble_service_state(uint8_t state) {}
+
+#endif // CONFIG_APP_BLE
+
+#endif // BLE_SERVICE_H
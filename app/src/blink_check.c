@@ -0,0 +1,210 @@
+/**
+ * @file blink_check.c
+ *
+ * Blinks LED2 at every led_frequency in turn and times its toggles through the LED observer,
+ * which the owner calls on the system workqueue as it writes each edge. Every interval
+ * between two toggles is compared to half the blink period, and the average and the worst
+ * error are printed per frequency.
+ *
+ * Blinks played by the PWM sequence (CONFIG_LED_BLINK_HW_SEQ) never reach the observer. Every
+ * toggle of those falls on a step of the one second sequence, so the sequence itself is timed
+ * instead: the controller raises SEQEND0 and SEQEND1 in turn, once a second, and nothing else
+ * looks at them while the sequence plays.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <inttypes.h>
+
+#ifdef CONFIG_LED_BLINK_HW_SEQ
+#include <hal/nrf_pwm.h>
+#endif
+
+#include "LED.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define BLINK_CHECK_STACK_SIZE    1024
+#define BLINK_CHECK_PRIORITY      7
+#define BLINK_CHECK_START_MS      200 // Let main finish its init and enter ENTRYA first
+#define BLINK_CHECK_LED           LED2 // The state machine blinks LED3, nothing drives LED2 without input
+#define BLINK_CHECK_TOGGLES       16 // Timed per frequency, 15 intervals
+#define BLINK_CHECK_SETTLE_MS     50 // Lets the owner write the off edge before the next frequency
+#define BLINK_CHECK_TOLERANCE_US  200 // Worst error allowed on any interval
+#define BLINK_CHECK_SEQ_US        1000000 // Between two sequence ends
+#define BLINK_CHECK_SEQ_ENDS      3 // Timed per frequency, 2 intervals
+#define BLINK_CHECK_POLL_US       50 // Between looks at the sequence end events
+
+BUILD_ASSERT(NUM_LEDS > BLINK_CHECK_LED, "the check blinks LED2");
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static void _blink_check_observe(led_id led, uint8_t duty_cycle);
+
+#ifdef CONFIG_LED_BLINK_HW_SEQ
+static bool _blink_check_seq(led_frequency frequency);
+#endif
+
+static bool _blink_check_one(led_frequency frequency);
+
+static void _blink_check_loop(void *p1, void *p2, void *p3);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+static const led_frequency _blink_check_frequencies[] = {LED_1HZ, LED_2HZ, LED_4HZ, LED_8HZ, LED_16HZ};
+
+static k_ticks_t _blink_check_stamps[BLINK_CHECK_TOGGLES]; // Written by the observer until full
+
+static atomic_t _blink_check_count = ATOMIC_INIT(0);
+
+K_THREAD_DEFINE(_blink_check, BLINK_CHECK_STACK_SIZE, _blink_check_loop, NULL, NULL, NULL,
+  BLINK_CHECK_PRIORITY, 0, BLINK_CHECK_START_MS);
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Stamps every edge written to the checked LED, until BLINK_CHECK_TOGGLES are in
+ *
+ * @param [in] led The LED that was written
+ * @param [in] duty_cycle Unused, the duty cycle it was written with
+ */
+static void _blink_check_observe(led_id led, uint8_t duty_cycle __attribute__((unused))) {
+  atomic_val_t count = atomic_get(&_blink_check_count);
+
+  if (BLINK_CHECK_LED != led || count >= BLINK_CHECK_TOGGLES) {
+    return;
+  }
+  _blink_check_stamps[count] = k_uptime_ticks();
+  atomic_set(&_blink_check_count, count + 1);
+}
+
+#ifdef CONFIG_LED_BLINK_HW_SEQ
+/**
+ * @brief Times the sequence playing the LED's blink by its end events
+ *
+ * @param [in] frequency The frequency being checked, for the printout
+ *
+ * @return true if every sequence took BLINK_CHECK_SEQ_US within BLINK_CHECK_TOLERANCE_US
+ */
+static bool _blink_check_seq(led_frequency frequency) {
+  NRF_PWM_Type *pwm = (NRF_PWM_Type *)DT_REG_ADDR(DT_PWMS_CTLR(DT_ALIAS(pwm_led2)));
+  k_ticks_t stamps[BLINK_CHECK_SEQ_ENDS];
+  uint32_t worst_us = 0;
+  uint64_t total_us = 0;
+  int ends = 0;
+
+  // The first end may belong to a sequence that started before the clear, it is only a start
+  nrf_pwm_event_clear(pwm, NRF_PWM_EVENT_SEQEND0);
+  nrf_pwm_event_clear(pwm, NRF_PWM_EVENT_SEQEND1);
+  int64_t deadline = k_uptime_get() + ((BLINK_CHECK_SEQ_ENDS + 1) * BLINK_CHECK_SEQ_US) / 1000;
+  while (ends < BLINK_CHECK_SEQ_ENDS && k_uptime_get() < deadline) {
+    if (nrf_pwm_event_check(pwm, NRF_PWM_EVENT_SEQEND0) || nrf_pwm_event_check(pwm, NRF_PWM_EVENT_SEQEND1)) {
+      stamps[ends++] = k_uptime_ticks();
+      nrf_pwm_event_clear(pwm, NRF_PWM_EVENT_SEQEND0);
+      nrf_pwm_event_clear(pwm, NRF_PWM_EVENT_SEQEND1);
+    } else {
+      k_usleep(BLINK_CHECK_POLL_US);
+    }
+  }
+
+  if (ends < BLINK_CHECK_SEQ_ENDS) {
+    printk("blink check: %d Hz from the PWM sequence, only %d sequence ends\n", frequency, ends);
+    return false;
+  }
+
+  for (int i = 1; i < BLINK_CHECK_SEQ_ENDS; i++) {
+    uint32_t interval_us = k_ticks_to_us_near32(stamps[i] - stamps[i - 1]);
+    uint32_t error_us = interval_us > BLINK_CHECK_SEQ_US ? interval_us - BLINK_CHECK_SEQ_US : BLINK_CHECK_SEQ_US - interval_us;
+
+    total_us += interval_us;
+    worst_us = MAX(worst_us, error_us);
+  }
+
+  printk("blink check: %d Hz from the PWM sequence, one loop every %" PRIu32 " us, measured %" PRIu32 " us avg, %" PRIu32 " us worst error\n",
+    frequency, (uint32_t)BLINK_CHECK_SEQ_US, (uint32_t)(total_us / (BLINK_CHECK_SEQ_ENDS - 1)), worst_us);
+  return worst_us <= BLINK_CHECK_TOLERANCE_US;
+}
+#endif
+
+/**
+ * @brief Blinks the LED at one frequency and checks every interval between its toggles, or
+ *        the sequence's timing if the PWM sequence plays the blink
+ *
+ * @param [in] frequency The frequency to check
+ *
+ * @return true if every interval was within BLINK_CHECK_TOLERANCE_US
+ */
+static bool _blink_check_one(led_frequency frequency) {
+  uint32_t expected_us = 500000 / frequency;
+  uint32_t worst_us = 0;
+  uint64_t total_us = 0;
+
+  atomic_set(&_blink_check_count, 0);
+  LED_blink(BLINK_CHECK_LED, frequency);
+
+#ifdef CONFIG_LED_BLINK_HW_SEQ
+  // The owner hands the blink to the sequence in the pass that applies it
+  k_msleep(BLINK_CHECK_SETTLE_MS);
+  if (LED_get_seq_mask() & BIT(BLINK_CHECK_LED)) {
+    bool ok = _blink_check_seq(frequency);
+
+    LED_set(BLINK_CHECK_LED, LED_OFF);
+    k_msleep(BLINK_CHECK_SETTLE_MS);
+    return ok;
+  }
+#endif
+
+  // Every toggle plus one spare half period
+  int64_t deadline = k_uptime_get() + ((BLINK_CHECK_TOGGLES + 2) * expected_us) / 1000;
+  while (atomic_get(&_blink_check_count) < BLINK_CHECK_TOGGLES && k_uptime_get() < deadline) {
+    k_msleep(expected_us / 1000);
+  }
+
+  LED_set(BLINK_CHECK_LED, LED_OFF);
+  k_msleep(BLINK_CHECK_SETTLE_MS);
+
+  atomic_val_t count = atomic_get(&_blink_check_count);
+  if (count < BLINK_CHECK_TOGGLES) {
+    printk("blink check: %d Hz, only %ld toggles\n", frequency, (long)count);
+    return false;
+  }
+
+  for (int i = 1; i < BLINK_CHECK_TOGGLES; i++) {
+    uint32_t interval_us = k_ticks_to_us_near32(_blink_check_stamps[i] - _blink_check_stamps[i - 1]);
+    uint32_t error_us = interval_us > expected_us ? interval_us - expected_us : expected_us - interval_us;
+
+    total_us += interval_us;
+    worst_us = MAX(worst_us, error_us);
+  }
+
+  printk("blink check: %d Hz toggles every %" PRIu32 " us, measured %" PRIu32 " us avg, %" PRIu32 " us worst error\n",
+    frequency, expected_us, (uint32_t)(total_us / (BLINK_CHECK_TOGGLES - 1)), worst_us);
+  return worst_us <= BLINK_CHECK_TOLERANCE_US;
+}
+
+/**
+ * @brief Checks every frequency once and prints the result
+ *
+ * @param [in] p1 Unused thread parameter 1
+ * @param [in] p2 Unused thread parameter 2
+ * @param [in] p3 Unused thread parameter 3
+ */
+static void _blink_check_loop(void *p1 __attribute__((unused)), void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
+  bool ok = true;
+
+  LED_set_observer(_blink_check_observe);
+  for (int i = 0; i < ARRAY_SIZE(_blink_check_frequencies); i++) {
+    ok &= _blink_check_one(_blink_check_frequencies[i]);
+  }
+  LED_set_observer(NULL);
+
+  if (ok) {
+    printk("blink check: done, every toggle within %d us\n", BLINK_CHECK_TOLERANCE_US);
+  } else {
+    printk("blink check: FAILED\n");
+  }
+}
@@ -0,0 +1,163 @@
+/**
+ * @file boot_prof.c
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <inttypes.h>
+
+#include "BTN.h"
+#include "LED.h"
+#include "boot_prof.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define BOOT_PROF_NUM_LINES     (NUM_BOOT_PHASES + 4) // The phases and a start and end per driver
+
+LOG_MODULE_DECLARE(app, CONFIG_APP_LOG_LEVEL);
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+typedef struct boot_prof_line_t {
+  const char *name;
+  uint32_t cycles; // k_cycle_get_32() at the phase, counted from reset
+  bool reached;
+} boot_prof_line;
+
+typedef struct boot_prof_log_t {
+  uint32_t cycles[NUM_BOOT_PHASES];
+  uint32_t reached; // Bitmask of boot_phase, only the first mark of a phase is kept
+} boot_prof_log;
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static int _boot_prof_kernel();
+
+static uint8_t _boot_prof_lines(boot_prof_line *lines);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+static boot_prof_log _boot_prof = {.reached=0};
+
+static const char *const _boot_prof_names[NUM_BOOT_PHASES] = {
+  [BOOT_PHASE_KERNEL]="kernel",
+  [BOOT_PHASE_MAIN]="main",
+  [BOOT_PHASE_SM_INIT]="state machine init",
+  [BOOT_PHASE_FIRST_RUN]="first run",
+  [BOOT_PHASE_FIRST_INPUT]="first input",
+};
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Marks the kernel phase, the first point where the cycle counter can be read
+ *
+ * @return Always 0
+ */
+static int _boot_prof_kernel() {
+  boot_prof_mark(BOOT_PHASE_KERNEL);
+  return 0;
+}
+
+/**
+ * @brief Collects the phases and the driver init times in boot order
+ *
+ * @param [out] lines Filled with BOOT_PROF_NUM_LINES entries
+ *
+ * @return Number of lines filled
+ */
+static uint8_t _boot_prof_lines(boot_prof_line *lines) {
+  uint8_t count = 0;
+
+  lines[count++] = (boot_prof_line){_boot_prof_names[BOOT_PHASE_KERNEL],
+    _boot_prof.cycles[BOOT_PHASE_KERNEL], _boot_prof.reached & BIT(BOOT_PHASE_KERNEL)};
+
+  // The drivers run from SYS_INIT, between the kernel and main
+  uint32_t start, end;
+  bool done = BTN_get_init_cycles(&start, &end);
+  lines[count++] = (boot_prof_line){"BTN init start", start, done};
+  lines[count++] = (boot_prof_line){"BTN init end", end, done};
+  done = LED_get_init_cycles(&start, &end);
+  lines[count++] = (boot_prof_line){"LED init start", start, done};
+  lines[count++] = (boot_prof_line){"LED init end", end, done};
+
+  for (uint8_t phase = BOOT_PHASE_MAIN; phase < NUM_BOOT_PHASES; phase++) {
+    lines[count++] = (boot_prof_line){_boot_prof_names[phase], _boot_prof.cycles[phase],
+      _boot_prof.reached & BIT(phase)};
+  }
+  return count;
+}
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Records the time a boot phase was reached, later marks of the same phase are ignored
+ *
+ * @param [in] phase The phase that was just reached
+ */
+void boot_prof_mark(boot_phase phase) {
+  if (phase >= NUM_BOOT_PHASES || (_boot_prof.reached & BIT(phase))) {
+    return;
+  }
+
+  _boot_prof.cycles[phase] = k_cycle_get_32();
+  _boot_prof.reached |= BIT(phase);
+
+  if (BOOT_PHASE_FIRST_INPUT == phase) {
+    boot_prof_report();
+  }
+}
+
+/**
+ * @brief Logs every phase reached so far, with its time since reset and since the line before
+ */
+void boot_prof_report() {
+  boot_prof_line lines[BOOT_PROF_NUM_LINES];
+  uint8_t count = _boot_prof_lines(lines);
+  uint32_t prev = 0;
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (!lines[i].reached) {
+      continue;
+    }
+    LOG_INF("boot: %-18s %8" PRIu32 " us (+%" PRIu32 " us)", lines[i].name,
+      k_cyc_to_us_floor32(lines[i].cycles), k_cyc_to_us_floor32(lines[i].cycles - prev));
+    prev = lines[i].cycles;
+  }
+}
+
+SYS_INIT(_boot_prof_kernel, POST_KERNEL, 0);
+
+/* ----------------------------------------------------------------------------
+                                Shell Commands
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_SHELL
+
+static int _boot_cmd_report(const struct shell *sh, size_t argc, char **argv) {
+  boot_prof_line lines[BOOT_PROF_NUM_LINES];
+  uint8_t count = _boot_prof_lines(lines);
+  uint32_t prev = 0;
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (!lines[i].reached) {
+      shell_print(sh, "%-18s not reached", lines[i].name);
+      continue;
+    }
+    shell_print(sh, "%-18s %8" PRIu32 " us (+%" PRIu32 " us)", lines[i].name,
+      k_cyc_to_us_floor32(lines[i].cycles), k_cyc_to_us_floor32(lines[i].cycles - prev));
+    prev = lines[i].cycles;
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(boot, NULL, "Show the boot phase timestamps", _boot_cmd_report);
+
+#endif // CONFIG_SHELL
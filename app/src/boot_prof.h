@@ -0,0 +1,43 @@
+/**
+ * @file boot_prof.h
+ *
+ * Boot phase timestamps, from the kernel coming up to the first input the state machine
+ * accepts, reported once that input arrives. Compiles to nothing unless
+ * CONFIG_APP_BOOT_PROFILE is enabled.
+ */
+
+#ifndef BOOT_PROF_H
+#define BOOT_PROF_H
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+                                    TYPES
+---------------------------------------------------------------------------- */
+typedef enum boot_phase_t {
+  BOOT_PHASE_KERNEL = 0, // Scheduler and timer up, start of the POST_KERNEL init level
+  BOOT_PHASE_MAIN, // main() entered, every SYS_INIT has run
+  BOOT_PHASE_SM_INIT, // state_machine_init() returned
+  BOOT_PHASE_FIRST_RUN, // First smf_run_state() returned
+  BOOT_PHASE_FIRST_INPUT, // First button press consumed by the state machine
+  NUM_BOOT_PHASES,
+} boot_phase;
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_APP_BOOT_PROFILE
+
+void boot_prof_mark(boot_phase phase);
+
+void boot_prof_report();
+
+#else
+
+static inline void boot_prof_mark(boot_phase phase) {}
+
+static inline void boot_prof_report() {}
+
+#endif // CONFIG_APP_BOOT_PROFILE
+
+#endif // BOOT_PROF_H
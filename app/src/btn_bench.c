@@ -0,0 +1,180 @@
+/**
+ * @file btn_bench.c
+ *
+ * Measures the BTN driver's press and release latency on native_sim. A set of bounce
+ * waveforms is played on one emulated button, and the time from the first edge of each
+ * press and release until the driver reports it is printed. Build it once per debounce
+ * strategy (CONFIG_BTN_DEBOUNCE_*) to compare them on the same contacts.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/sys/printk.h>
+#include <inttypes.h>
+
+#include "BTN.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define BTN_BENCH_STACK_SIZE    1024
+#define BTN_BENCH_PRIORITY      7
+#define BTN_BENCH_START_MS      100 // Let main finish its init first
+#define BTN_BENCH_BTN           BTN2 // Only starts the entry over, so the state machine stays put
+#define BTN_BENCH_POLL_US       20 // Resolution of the measured latency
+#define BTN_BENCH_TIMEOUT_US    200000 // Give up on an edge the driver never reports
+#define BTN_BENCH_HOLD_MS       100 // Between the press and the release, and after the release
+#define BTN_BENCH_MAX_EDGES     16
+
+#if defined(CONFIG_BTN_DEBOUNCE_LOCKOUT)
+#define BTN_BENCH_STRATEGY      "lockout"
+#elif defined(CONFIG_BTN_DEBOUNCE_INTEGRATOR)
+#define BTN_BENCH_STRATEGY      "integrator"
+#else
+#define BTN_BENCH_STRATEGY      "delayed"
+#endif
+
+/* ----------------------------------------------------------------------------
+                                  Macro Helpers
+---------------------------------------------------------------------------- */
+#define BENCH_BTN_SPEC(node_id)  GPIO_DT_SPEC_GET(node_id, gpios),
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+/*
+ * The contact toggles at every time in edges_us, starting from the opposite level, and ends
+ * on the level being entered. An odd count is needed for that
+ */
+typedef struct btn_bench_bounce_t {
+  uint8_t count;
+  uint16_t edges_us[BTN_BENCH_MAX_EDGES]; // Relative to the first edge, which is at 0
+} btn_bench_bounce;
+
+typedef struct btn_bench_waveform_t {
+  const char *name;
+  btn_bench_bounce press;
+  btn_bench_bounce release;
+} btn_bench_waveform;
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static uint32_t _bench_reported();
+
+static void _bench_wait(uint32_t start, uint32_t until_us, uint32_t before, int32_t *latency_us);
+
+static int32_t _bench_edge(const btn_bench_bounce *bounce, bool level);
+
+static void _bench_loop(void *p1, void *p2, void *p3);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+static const struct gpio_dt_spec _bench_btns[NUM_BTNS] = {
+  DT_FOREACH_CHILD_STATUS_OKAY(BTN_DT_PARENT, BENCH_BTN_SPEC)
+};
+
+static const btn_bench_waveform _bench_waveforms[] = {
+  {"clean", {1, {0}}, {1, {0}}},
+  {"short bounce", {5, {0, 100, 250, 400, 600}}, {5, {0, 80, 200, 350, 500}}},
+  {"long bounce", {9, {0, 300, 900, 1500, 2400, 3000, 4200, 5000, 6500}},
+    {7, {0, 500, 1200, 2000, 3100, 4000, 5500}}},
+  {"worn contact", {15, {0, 200, 500, 900, 1400, 2000, 2700, 3500, 4400, 5400, 6500, 7700,
+    9000, 10400, 11900}}, {11, {0, 400, 1000, 1800, 2800, 4000, 5400, 7000, 8800, 10800, 13000}}},
+};
+
+K_THREAD_DEFINE(_btn_bench, BTN_BENCH_STACK_SIZE, _bench_loop, NULL, NULL, NULL,
+  BTN_BENCH_PRIORITY, 0, BTN_BENCH_START_MS);
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Gets how many edges the driver has reported so far
+ *
+ * @return Debounced presses and releases since boot
+ */
+static uint32_t _bench_reported() {
+  btn_event_stats stats;
+  BTN_get_event_stats(&stats);
+  return stats.reported;
+}
+
+/**
+ * @brief Busy waits until a time after the first edge, catching the first report on the way.
+ *        Busy waiting keeps the contact timing exact while the driver's work items still run
+ *
+ * @param [in] start k_cycle_get_32() at the first edge
+ * @param [in] until_us Time after the first edge to return at
+ * @param [in] before Reported edge count before the first edge
+ * @param [in,out] latency_us Set to the time of the first report after the first edge, if still < 0
+ */
+static void _bench_wait(uint32_t start, uint32_t until_us, uint32_t before, int32_t *latency_us) {
+  uint32_t now_us;
+
+  do {
+    now_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    if (*latency_us < 0 && _bench_reported() != before) {
+      *latency_us = now_us;
+    }
+    if (now_us < until_us) {
+      k_busy_wait(BTN_BENCH_POLL_US);
+    }
+  } while (now_us < until_us);
+}
+
+/**
+ * @brief Plays one bounce on the bench button and times its report
+ *
+ * @param [in] bounce The edges to play
+ * @param [in] level The level the contact ends on, true when pressed
+ *
+ * @return Microseconds from the first edge to the report, < 0 if it was never reported
+ */
+static int32_t _bench_edge(const btn_bench_bounce *bounce, bool level) {
+  const struct gpio_dt_spec *spec = &_bench_btns[BTN_BENCH_BTN];
+  uint32_t before = _bench_reported();
+  uint32_t start = k_cycle_get_32();
+  int32_t latency_us = -1;
+
+  for (uint8_t i = 0; i < bounce->count; i++) {
+    _bench_wait(start, bounce->edges_us[i], before, &latency_us);
+    gpio_emul_input_set(spec->port, spec->pin, (i % 2) ? !level : level);
+  }
+
+  uint32_t last_us = bounce->edges_us[bounce->count - 1];
+  while (latency_us < 0 && last_us < BTN_BENCH_TIMEOUT_US) {
+    last_us += BTN_BENCH_POLL_US;
+    _bench_wait(start, last_us, before, &latency_us);
+  }
+  return latency_us;
+}
+
+/**
+ * @brief Plays every waveform once and prints the press and release latency of each
+ *
+ * @param [in] p1 Unused thread parameter 1
+ * @param [in] p2 Unused thread parameter 2
+ * @param [in] p3 Unused thread parameter 3
+ */
+static void _bench_loop(void *p1 __attribute__((unused)), void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
+  printk("bench: %s debounce, %d ms\n", BTN_BENCH_STRATEGY, CONFIG_BTN_DEBOUNCE_MS);
+
+  for (size_t i = 0; i < ARRAY_SIZE(_bench_waveforms); i++) {
+    const btn_bench_waveform *waveform = &_bench_waveforms[i];
+
+    int32_t press_us = _bench_edge(&waveform->press, true);
+    k_msleep(BTN_BENCH_HOLD_MS);
+    int32_t release_us = _bench_edge(&waveform->release, false);
+    k_msleep(BTN_BENCH_HOLD_MS);
+
+    printk("bench: %-12s press %6" PRId32 " us, release %6" PRId32 " us\n", waveform->name,
+      press_us, release_us);
+  }
+
+  btn_event_stats stats;
+  BTN_get_event_stats(&stats);
+  printk("bench: done, %" PRIu32 " reported, %" PRIu32 " dropped\n", stats.reported, stats.dropped);
+}
@@ -0,0 +1,127 @@
+/**
+ * @file btn_replay.c
+ *
+ * Plays a recorded button trace (see BTN_trace_dump) back on the emulated buttons of
+ * native_sim. Every edge is applied to the GPIO at its recorded time, so it goes through the
+ * same interrupt, debounce and event path as a real press while the state machine and LED
+ * driver run. The input and every LED change are printed with their time since the start of
+ * the replay, interleaved with the application's own console output, giving a timeline that
+ * can be diffed between state machine changes.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/sys/printk.h>
+#include <inttypes.h>
+
+#include "BTN.h"
+#include "LED.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define BTN_REPLAY_STACK_SIZE   1024
+#define BTN_REPLAY_PRIORITY     7
+#define BTN_REPLAY_START_MS     100 // Let main finish its init first
+#define BTN_REPLAY_SETTLE_MS    1000 // Keep logging LEDs this long after the last edge
+
+/* ----------------------------------------------------------------------------
+                                  Macro Helpers
+---------------------------------------------------------------------------- */
+#define REPLAY_BTN_SPEC(node_id)  GPIO_DT_SPEC_GET(node_id, gpios),
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static uint32_t _replay_now_ms();
+
+static void _replay_led_changed(led_id led, uint8_t duty_cycle);
+
+static void _replay_loop(void *p1, void *p2, void *p3);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+static const struct gpio_dt_spec _replay_btns[NUM_BTNS] = {
+  DT_FOREACH_CHILD_STATUS_OKAY(BTN_DT_PARENT, REPLAY_BTN_SPEC)
+};
+
+static const btn_trace_entry _replay_trace[] = {
+#include CONFIG_APP_BTN_REPLAY_TRACE
+};
+
+static k_ticks_t _replay_start = 0;
+
+static uint8_t _replay_leds[NUM_LEDS]; // Last duty cycle printed for every LED
+
+K_THREAD_DEFINE(_btn_replay, BTN_REPLAY_STACK_SIZE, _replay_loop, NULL, NULL, NULL,
+  BTN_REPLAY_PRIORITY, 0, BTN_REPLAY_START_MS);
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Gets the time since the replay started
+ *
+ * @return Milliseconds since the replay started
+ */
+static uint32_t _replay_now_ms() {
+  return (uint32_t)k_ticks_to_ms_floor64(k_uptime_ticks() - _replay_start);
+}
+
+/**
+ * @brief Prints an LED whose duty cycle changed, writes that leave it where it was are skipped
+ *
+ * @param [in] led The LED that was written
+ * @param [in] duty_cycle Its new duty cycle, 0 - 100
+ */
+static void _replay_led_changed(led_id led, uint8_t duty_cycle) {
+  if (duty_cycle == _replay_leds[led]) {
+    return;
+  }
+  _replay_leds[led] = duty_cycle;
+  printk("[%8" PRIu32 " ms] LED%u %u%%\n", _replay_now_ms(), led, duty_cycle);
+}
+
+/**
+ * @brief Applies every edge of the trace at its recorded time, relative to the first edge
+ *
+ * @param [in] p1 Unused thread parameter 1
+ * @param [in] p2 Unused thread parameter 2
+ * @param [in] p3 Unused thread parameter 3
+ */
+static void _replay_loop(void *p1 __attribute__((unused)), void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
+  if (0 == ARRAY_SIZE(_replay_trace)) {
+    return;
+  }
+
+  uint32_t first_us = _replay_trace[0].time_us;
+
+  _replay_start = k_uptime_ticks();
+  LED_set_observer(_replay_led_changed);
+  printk("replay: %u edges\n", (unsigned int)ARRAY_SIZE(_replay_trace));
+
+  for (size_t i = 0; i < ARRAY_SIZE(_replay_trace); i++) {
+    const btn_trace_entry *entry = &_replay_trace[i];
+
+    if (entry->btn >= NUM_BTNS) {
+      continue;
+    }
+
+    // Absolute deadlines so the time spent printing doesn't push later edges back
+    k_sleep(K_TIMEOUT_ABS_TICKS(_replay_start + k_us_to_ticks_near64(entry->time_us - first_us)));
+    printk("[%8" PRIu32 " ms] BTN%u %s\n", _replay_now_ms(), entry->btn,
+      BTN_EDGE_PRESS == entry->edge ? "press" : "release");
+    gpio_emul_input_set(_replay_btns[entry->btn].port, _replay_btns[entry->btn].pin,
+      BTN_EDGE_PRESS == entry->edge);
+  }
+
+  k_msleep(BTN_REPLAY_SETTLE_MS);
+  LED_set_observer(NULL);
+
+  btn_event_stats stats;
+  BTN_get_event_stats(&stats);
+  printk("replay: done in %" PRIu32 " ms, %" PRIu32 " overflowed, %" PRIu32 " dropped\n",
+    _replay_now_ms(), stats.overflow, stats.dropped);
+}
@@ -0,0 +1,152 @@
+/**
+ * @file deferred.c
+ *
+ * Actions that run on the main thread after a delay, so states never have to sleep.
+ * Each slot is a kernel timer whose expiry posts an APP_EVENT_DEFERRED, the main loop
+ * then calls deferred_dispatch() before running the state machine.
+ */
+
+#include <zephyr/kernel.h>
+
+#include "app_event.h"
+#include "deferred.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define DEFERRED_RETRY_MS   1 // Retry posting an expired slot while the event queue is full
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+typedef struct deferred_slot_t {
+  struct k_timer timer;
+  deferred_fn fn;
+  uint32_t arg;
+  bool active;
+} deferred_slot;
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static void _deferred_expiry(struct k_timer *timer);
+
+static int _deferred_find(deferred_fn fn, uint32_t arg);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+static deferred_slot _slots[CONFIG_APP_DEFERRED_SLOTS];
+
+/*
+ * Set by the timer ISR, cleared on the main thread. A slot that was re-armed or
+ * cancelled after its event was posted has its bit cleared, so the stale event is ignored.
+ */
+static atomic_t _fired = ATOMIC_INIT(0);
+
+BUILD_ASSERT(CONFIG_APP_DEFERRED_SLOTS <= 32, "slots are tracked in one atomic_t");
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Hands an expired slot to the main loop. If the event queue is full the slot stays
+ *        pending and is tried again shortly, so the action is late rather than lost
+ *
+ * @param [in] timer The expired slot timer
+ */
+static void _deferred_expiry(struct k_timer *timer) {
+  deferred_slot *slot = CONTAINER_OF(timer, deferred_slot, timer);
+  uint8_t index = slot - _slots;
+
+  atomic_set_bit(&_fired, index);
+  if (app_event_post(APP_EVENT_DEFERRED, index) < 0) {
+    atomic_clear_bit(&_fired, index);
+    k_timer_start(&slot->timer, K_MSEC(DEFERRED_RETRY_MS), K_NO_WAIT);
+  }
+}
+
+/**
+ * @brief Finds the active slot holding an action, or the first free slot
+ *
+ * @param [in] fn The action to look for
+ * @param [in] arg The argument it was scheduled with
+ *
+ * @return Slot index, -ENOMEM if the action isn't scheduled and every slot is in use
+ */
+static int _deferred_find(deferred_fn fn, uint32_t arg) {
+  int free_slot = -ENOMEM;
+
+  for (int i = 0; i < CONFIG_APP_DEFERRED_SLOTS; i++) {
+    if (_slots[i].active && _slots[i].fn == fn && _slots[i].arg == arg) {
+      return i;
+    } else if (!_slots[i].active && free_slot < 0) {
+      free_slot = i;
+    }
+  }
+  return free_slot;
+}
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Runs fn(arg) on the main thread after a delay. Scheduling an action that is
+ *        already pending restarts its delay instead of running it twice
+ *
+ * @param [in] fn The action to run
+ * @param [in] arg Passed to fn
+ * @param [in] delay_ms How long to wait before running it
+ *
+ * @return Error code, < 0 on failures (-ENOMEM if every slot is in use)
+ */
+int deferred_schedule(deferred_fn fn, uint32_t arg, uint32_t delay_ms) {
+  if (!fn) {
+    return -EINVAL;
+  }
+
+  int index = _deferred_find(fn, arg);
+  if (index < 0) {
+    return index;
+  }
+
+  deferred_slot *slot = &_slots[index];
+  if (!slot->active) {
+    k_timer_init(&slot->timer, _deferred_expiry, NULL);
+  }
+  k_timer_stop(&slot->timer);
+  atomic_clear_bit(&_fired, index);
+
+  slot->fn = fn;
+  slot->arg = arg;
+  slot->active = true;
+  k_timer_start(&slot->timer, K_MSEC(delay_ms), K_NO_WAIT);
+  return 0;
+}
+
+/**
+ * @brief Cancels every pending action
+ */
+void deferred_cancel_all() {
+  for (int i = 0; i < CONFIG_APP_DEFERRED_SLOTS; i++) {
+    if (_slots[i].active) {
+      k_timer_stop(&_slots[i].timer);
+      _slots[i].active = false;
+    }
+  }
+  atomic_clear(&_fired);
+}
+
+/**
+ * @brief Runs the action of an expired slot, called by the main loop for APP_EVENT_DEFERRED
+ *
+ * @param [in] slot The slot index carried by the event
+ */
+void deferred_dispatch(uint8_t slot) {
+  if (slot >= CONFIG_APP_DEFERRED_SLOTS || !atomic_test_and_clear_bit(&_fired, slot)) {
+    return;
+  }
+
+  _slots[slot].active = false;
+  _slots[slot].fn(_slots[slot].arg);
+}
@@ -0,0 +1,24 @@
+/**
+ * @file deferred.h
+ */
+
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+                                    TYPES
+---------------------------------------------------------------------------- */
+typedef void (*deferred_fn)(uint32_t arg);
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+int deferred_schedule(deferred_fn fn, uint32_t arg, uint32_t delay_ms);
+
+void deferred_cancel_all();
+
+void deferred_dispatch(uint8_t slot);
+
+#endif // DEFERRED_H
@@ -0,0 +1,316 @@
+/**
+ * @file led_stress.c
+ *
+ * Hammers the LED driver from several threads and a timer ISR at once, then checks what the
+ * owner made of it: frames committed on LED0 and LED1 must never be seen half applied, every
+ * -ENOBUFS a caller got must be in the overflow counter, toggles must not be merged, the
+ * last command for every LED must win once everything has settled, and the PWM controller
+ * must be released as often as it was taken once every LED is off again.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <inttypes.h>
+
+#include "LED.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define LED_STRESS_STACK_SIZE     1024
+#define LED_STRESS_PRIORITY       7 // Above the producers, so it can stop them
+#define LED_STRESS_WORKER_PRIORITY  8 // Producers and the frame check share it and yield in turn
+#define LED_STRESS_HAMMERS        2
+#define LED_STRESS_MAX_BURST      12 // More than a ring holds, so bursts overflow it
+#define LED_STRESS_START_MS       200 // Let main finish its init and enter ENTRYA first
+#define LED_STRESS_RUN_MS         500
+#define LED_STRESS_ISR_US         700 // Not a multiple of the fade step, so the ISR drifts through passes
+#define LED_STRESS_SETTLE_MS      50 // Longer than a pass with full rings
+#define LED_STRESS_TOGGLES        5 // Odd, so the LED ends up lit
+#define LED_STRESS_FINAL_DUTY     10
+
+BUILD_ASSERT(NUM_LEDS > LED3, "LED0 and LED1 take the frames, LED2 and LED3 the hammers");
+BUILD_ASSERT(LED_STRESS_TOGGLES + 1 <= CONFIG_LED_CMD_QUEUE_SIZE, "the toggle check must not overflow");
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static void _stress_count(int rv);
+
+static uint32_t _stress_rand(uint32_t *state);
+
+static void _stress_isr(struct k_timer *timer);
+
+static void _stress_hammer_one(uint32_t r);
+
+static void _stress_hammer(void *p1, void *p2, void *p3);
+
+static void _stress_frames(void *p1, void *p2, void *p3);
+
+static void _stress_check_frames(void *p1, void *p2, void *p3);
+
+static bool _stress_check_toggles();
+
+static bool _stress_check_settled();
+
+static bool _stress_check_pm();
+
+static void _stress_loop(void *p1, void *p2, void *p3);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+static const led_step _stress_steps[] = {{5, LED_MAX_DUTY_CYCLE}, {5, 0}, {10, 40}};
+
+static const led_pattern _stress_pattern = {_stress_steps, ARRAY_SIZE(_stress_steps), true};
+
+static atomic_t _stress_running = ATOMIC_INIT(0);
+
+static atomic_t _stress_commands = ATOMIC_INIT(0); // Calls made by every producer
+
+static atomic_t _stress_nobufs = ATOMIC_INIT(0); // Calls that returned -ENOBUFS
+
+static atomic_t _stress_errors = ATOMIC_INIT(0); // Calls that returned any other error
+
+static uint32_t _stress_torn = 0; // Only written by the frame check
+
+// The hammers, then the frame producer, then the frame check
+#define LED_STRESS_WORKERS        (LED_STRESS_HAMMERS + 2)
+
+K_THREAD_STACK_ARRAY_DEFINE(_stress_stacks, LED_STRESS_WORKERS, LED_STRESS_STACK_SIZE);
+
+static struct k_thread _stress_threads[LED_STRESS_WORKERS];
+
+K_TIMER_DEFINE(_stress_timer, _stress_isr, NULL);
+
+K_THREAD_DEFINE(_led_stress, LED_STRESS_STACK_SIZE, _stress_loop, NULL, NULL, NULL,
+  LED_STRESS_PRIORITY, 0, LED_STRESS_START_MS);
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Counts a call to the LED driver and what it returned
+ *
+ * @param [in] rv The return value of the call
+ */
+static void _stress_count(int rv) {
+  atomic_inc(&_stress_commands);
+  if (-ENOBUFS == rv) {
+    atomic_inc(&_stress_nobufs);
+  } else if (rv < 0) {
+    atomic_inc(&_stress_errors);
+  }
+}
+
+/**
+ * @brief xorshift32, every producer has its own state so they need no locking
+ *
+ * @param [in,out] state The producer's state, never 0
+ *
+ * @return The next pseudo random number
+ */
+static uint32_t _stress_rand(uint32_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+/**
+ * @brief Toggles LED2 from the timer ISR while the threads run
+ *
+ * @param [in] timer Unused, the stress timer
+ */
+static void _stress_isr(struct k_timer *timer __attribute__((unused))) {
+  _stress_count(LED_toggle(LED2));
+}
+
+/**
+ * @brief Posts one random command to LED2 or LED3
+ *
+ * @param [in] r A random number that picks the LED, the command and its arguments
+ */
+static void _stress_hammer_one(uint32_t r) {
+  led_id led = (r & BIT(0)) ? LED3 : LED2;
+  uint8_t duty = (r >> 8) % (LED_MAX_DUTY_CYCLE + 1);
+
+  switch ((r >> 1) % 5) {
+    case 0:
+      _stress_count(LED_pwm(led, duty));
+      break;
+    case 1:
+      _stress_count(LED_toggle(led));
+      break;
+    case 2:
+      _stress_count(LED_fade(led, duty, 60, LED_CURVE_GAMMA));
+      break;
+    case 3:
+      _stress_count(LED_breathe(led, 0, duty, 200, LED_CURVE_LINEAR));
+      break;
+    default:
+      _stress_count(LED_play(led, &_stress_pattern));
+      break;
+  }
+}
+
+/**
+ * @brief Posts bursts of random commands to LED2 and LED3 until the run is over. Each burst
+ *        runs with the scheduler locked so the owner can't drain the rings in between
+ *
+ * @param [in] p1 Seed for this hammer
+ * @param [in] p2 Unused thread parameter 2
+ * @param [in] p3 Unused thread parameter 3
+ */
+static void _stress_hammer(void *p1, void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
+  uint32_t state = (uint32_t)(uintptr_t)p1;
+
+  while (atomic_get(&_stress_running)) {
+    uint32_t burst = 1 + _stress_rand(&state) % LED_STRESS_MAX_BURST;
+
+    k_sched_lock();
+    for (uint32_t i = 0; i < burst; i++) {
+      _stress_hammer_one(_stress_rand(&state));
+    }
+    k_sched_unlock();
+    k_yield();
+  }
+}
+
+/**
+ * @brief Commits frames that set LED0 and LED1 to the same duty cycle until the run is over
+ *
+ * @param [in] p1 Unused thread parameter 1
+ * @param [in] p2 Unused thread parameter 2
+ * @param [in] p3 Unused thread parameter 3
+ */
+static void _stress_frames(void *p1 __attribute__((unused)), void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
+  uint8_t duty[NUM_LEDS] = {0};
+  uint8_t level = 0;
+
+  while (atomic_get(&_stress_running)) {
+    level = (level + 1) % (LED_MAX_DUTY_CYCLE + 1);
+    duty[LED0] = level;
+    duty[LED1] = level;
+    LED_frame_set(BIT(LED0) | BIT(LED1), duty);
+    _stress_count(LED_frame_commit());
+    k_yield();
+  }
+}
+
+/**
+ * @brief Reads LED0 and LED1 back for as long as the run lasts. The owner runs cooperatively,
+ *        so a reading of LED0 that held on both sides of LED1 but differs from it is a frame
+ *        that was applied over two passes
+ *
+ * @param [in] p1 Unused thread parameter 1
+ * @param [in] p2 Unused thread parameter 2
+ * @param [in] p3 Unused thread parameter 3
+ */
+static void _stress_check_frames(void *p1 __attribute__((unused)), void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
+  while (atomic_get(&_stress_running)) {
+    uint8_t first = LED_get_pwm(LED0);
+    uint8_t second = LED_get_pwm(LED1);
+    if (first == LED_get_pwm(LED0) && first != second) {
+      _stress_torn++;
+    }
+    k_yield();
+  }
+}
+
+/**
+ * @brief Posts an odd number of toggles to an LED that is off before the owner can run
+ *
+ * @return true if it ended up lit, none of the toggles were merged
+ */
+static bool _stress_check_toggles() {
+  LED_pwm(LED2, 0);
+  for (int i = 0; i < LED_STRESS_TOGGLES; i++) {
+    LED_toggle(LED2);
+  }
+  k_msleep(LED_STRESS_SETTLE_MS);
+  return LED_MAX_DUTY_CYCLE == LED_get_pwm(LED2);
+}
+
+/**
+ * @brief Sets every LED to its own duty cycle once the producers have stopped
+ *
+ * @return true if every LED ended up on the last duty cycle it was given
+ */
+static bool _stress_check_settled() {
+  bool settled = true;
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    LED_pwm(i, LED_STRESS_FINAL_DUTY + i);
+  }
+  k_msleep(LED_STRESS_SETTLE_MS);
+  for (int i = 0; i < NUM_LEDS; i++) {
+    settled &= (LED_STRESS_FINAL_DUTY + i == LED_get_pwm(i));
+  }
+  return settled;
+}
+
+/**
+ * @brief Turns every LED off and compares the runtime PM counters
+ *
+ * @return true if the controller was suspended once for every time it was resumed
+ */
+static bool _stress_check_pm() {
+  led_pm_stats stats;
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    LED_pwm(i, 0);
+  }
+  k_msleep(LED_STRESS_SETTLE_MS);
+  LED_get_pm_stats(&stats);
+  printk("led stress: pm %" PRIu32 " suspends, %" PRIu32 " resumes\n", stats.suspends, stats.resumes);
+  return stats.resumes && stats.suspends == stats.resumes;
+}
+
+/**
+ * @brief Starts the producers and the frame check, stops them after the run and prints the
+ *        results
+ *
+ * @param [in] p1 Unused thread parameter 1
+ * @param [in] p2 Unused thread parameter 2
+ * @param [in] p3 Unused thread parameter 3
+ */
+static void _stress_loop(void *p1 __attribute__((unused)), void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
+  static const k_thread_entry_t entries[LED_STRESS_WORKERS - LED_STRESS_HAMMERS] = {
+    _stress_frames, _stress_check_frames,
+  };
+  led_cmd_stats before;
+  led_cmd_stats after;
+
+  LED_get_cmd_stats(&before);
+  atomic_set(&_stress_running, 1);
+
+  for (int i = 0; i < LED_STRESS_WORKERS; i++) {
+    k_thread_entry_t entry = (i < LED_STRESS_HAMMERS) ? _stress_hammer : entries[i - LED_STRESS_HAMMERS];
+    k_thread_create(&_stress_threads[i], _stress_stacks[i], K_THREAD_STACK_SIZEOF(_stress_stacks[i]),
+      entry, (void *)(uintptr_t)(0x9E3779B9u + i), NULL, NULL, LED_STRESS_WORKER_PRIORITY, 0, K_NO_WAIT);
+  }
+  k_timer_start(&_stress_timer, K_USEC(LED_STRESS_ISR_US), K_USEC(LED_STRESS_ISR_US));
+
+  k_msleep(LED_STRESS_RUN_MS);
+
+  atomic_set(&_stress_running, 0);
+  k_timer_stop(&_stress_timer);
+  for (int i = 0; i < LED_STRESS_WORKERS; i++) {
+    k_thread_join(&_stress_threads[i], K_FOREVER);
+  }
+  k_msleep(LED_STRESS_SETTLE_MS);
+
+  LED_get_cmd_stats(&after);
+  uint32_t overflows = after.overflows - before.overflows;
+  bool toggles = _stress_check_toggles();
+  bool settled = _stress_check_settled();
+  bool pm = _stress_check_pm();
+
+  printk("led stress: %" PRIu32 " commands, %" PRIu32 " overflowed (%" PRIu32 " counted), %" PRIu32
+    " failed, %" PRIu32 " torn frames\n", (uint32_t)atomic_get(&_stress_commands),
+    (uint32_t)atomic_get(&_stress_nobufs), overflows, (uint32_t)atomic_get(&_stress_errors), _stress_torn);
+  printk("led stress: done, overflows %s, toggles %s, settled %s, pm %s\n",
+    (overflows == (uint32_t)atomic_get(&_stress_nobufs)) ? "match" : "MISMATCH",
+    toggles ? "ok" : "MERGED", settled ? "ok" : "FAILED", pm ? "balanced" : "UNBALANCED");
+}
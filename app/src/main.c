@@ -6,15 +6,39 @@
 
 #include <zephyr/kernel.h>
 #include <zephyr/sys/printk.h>
+#include <zephyr/logging/log.h>
 
 #include "BTN.h"
 #include "LED.h"
+#include "app_event.h"
+#include "ble_service.h"
+#include "boot_prof.h"
+#include "deferred.h"
 #include "my_state_machine.h"
+#include "persist.h"
 
 #define SLEEP_MS 1
 
+LOG_MODULE_REGISTER(app, CONFIG_APP_LOG_LEVEL);
+
+#ifdef CONFIG_APP_EVENT_DRIVEN
+#define MAIN_WAIT K_FOREVER
+#else
+#define MAIN_WAIT K_MSEC(SLEEP_MS)
+#endif
+
+static void on_button(btn_id btn) {
+  app_event_post(APP_EVENT_BTN, btn);
+}
+
+static void on_led_done(led_id led) {
+  app_event_post(APP_EVENT_DRIVER, led);
+}
+
 int main(void) {
+  boot_prof_mark(BOOT_PHASE_MAIN);
 
+  // Both drivers already ran from SYS_INIT, these only pick up how that went
   if (0 > BTN_init()) {
     return 0;
   }
@@ -22,17 +46,35 @@ int main(void) {
     return 0;
   }
 
+  // The password entry works without a radio, so a BLE failure is only logged. The controller
+  // comes up in the background while the state machine already takes input
+  ble_service_init();
+
+  // Without storage the state machine just starts from scratch
+  persist_init();
+
+  BTN_set_callback(on_button);
+  LED_set_done_callback(on_led_done);
   state_machine_init();
+  boot_prof_mark(BOOT_PHASE_SM_INIT);
 
   while(1) {
-    
+    app_event evt;
+
     int ret = state_machine_run();
     if (0 > ret) {
       return 0;
     }
 
-    k_msleep(SLEEP_MS);
+    // Polled mode wakes every SLEEP_MS, event-driven mode only when something is posted
+    if (0 == app_event_wait(&evt, MAIN_WAIT)) {
+      if (APP_EVENT_DEFERRED == evt.type) {
+        deferred_dispatch(evt.data);
+      } else if (APP_EVENT_DRIVER == evt.type) {
+        state_machine_led_done(evt.data);
+      }
+    }
+    app_event_count_wakeup();
   }
 	return 0;
 }
-
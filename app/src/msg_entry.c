@@ -0,0 +1,146 @@
+/**
+ * @file msg_entry.c
+ *
+ * Message entered one bit at a time, MSB first. Bits are shifted into a byte wide
+ * accumulator alongside a mask with one bit set per bit entered, so a completed byte is
+ * simply the accumulator once the mask is full. Completed bytes stream into a ring
+ * buffer, which lets messages be any length while only the main thread touches it.
+ */
+
+#include <zephyr/kernel.h>
+
+#include "msg_entry.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define MSG_ENTRY_RING_MASK   (CONFIG_APP_MSG_RING_SIZE - 1)
+#define MSG_ENTRY_BYTE_FULL   0xFF
+
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_APP_MSG_RING_SIZE), "ring indices wrap with a mask");
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+typedef struct msg_entry_t {
+  uint8_t bits; // Byte in progress, the latest bit is the LSB
+  uint8_t valid; // One set bit per bit entered into the byte in progress
+  uint16_t head; // Free running, next byte is written at head & MSG_ENTRY_RING_MASK
+  uint16_t tail; // Free running, oldest byte is at tail & MSG_ENTRY_RING_MASK
+  uint32_t dropped; // Completed bytes lost because the ring was full
+  uint8_t ring[CONFIG_APP_MSG_RING_SIZE];
+} msg_entry;
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+static msg_entry _msg = {.head=0, .tail=0};
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Discards the whole message, including any partially entered byte
+ */
+void msg_entry_reset() {
+  _msg.bits = 0;
+  _msg.valid = 0;
+  _msg.tail = _msg.head;
+}
+
+/**
+ * @brief Enters the next bit of the message, completing a byte on every 8th bit
+ *
+ * @param [in] bit 0 or 1, anything else counts as 1
+ *
+ * @return true if the bit completed a byte and it was added to the message
+ */
+bool msg_entry_push_bit(uint8_t bit) {
+  _msg.bits = (_msg.bits << 1) | (bit ? 1 : 0);
+  _msg.valid = (_msg.valid << 1) | 1;
+
+  if (MSG_ENTRY_BYTE_FULL != _msg.valid) {
+    return false;
+  }
+
+  _msg.valid = 0;
+  return msg_entry_push_byte(_msg.bits);
+}
+
+/**
+ * @brief Appends a whole byte to the message, e.g. one restored after a reset. A partially
+ *        entered byte is left as it is
+ *
+ * @param [in] byte The completed byte
+ *
+ * @return true if it was added, false if the ring was full
+ */
+bool msg_entry_push_byte(uint8_t byte) {
+  if ((uint16_t)(_msg.head - _msg.tail) >= CONFIG_APP_MSG_RING_SIZE) {
+    _msg.dropped++;
+    return false;
+  }
+  _msg.ring[_msg.head++ & MSG_ENTRY_RING_MASK] = byte;
+  return true;
+}
+
+/**
+ * @brief Discards the partially entered byte, completed bytes are kept
+ */
+void msg_entry_clear_partial() {
+  _msg.bits = 0;
+  _msg.valid = 0;
+}
+
+/**
+ * @brief Drops the partially entered byte and every completed byte after the first len
+ *
+ * @param [in] len Completed bytes to keep
+ */
+void msg_entry_truncate(uint16_t len) {
+  msg_entry_clear_partial();
+  if (len < msg_entry_len()) {
+    _msg.head = _msg.tail + len;
+  }
+}
+
+/**
+ * @brief Gets the number of completed bytes in the message
+ *
+ * @return Completed bytes waiting in the ring
+ */
+uint16_t msg_entry_len() {
+  return _msg.head - _msg.tail;
+}
+
+/**
+ * @brief Gets how many bits of the next byte have been entered
+ *
+ * @return 0 - 7
+ */
+uint8_t msg_entry_partial_bits() {
+  return POPCOUNT(_msg.valid);
+}
+
+/**
+ * @brief Gets a completed byte without removing it from the message
+ *
+ * @param [in] index Position in the message, 0 is the oldest byte
+ *
+ * @return The byte, 0 if index is past the end of the message
+ */
+uint8_t msg_entry_peek(uint16_t index) {
+  if (index >= msg_entry_len()) {
+    return 0;
+  }
+  return _msg.ring[(_msg.tail + index) & MSG_ENTRY_RING_MASK];
+}
+
+/**
+ * @brief Gets the number of completed bytes lost because the ring was full
+ *
+ * @return Dropped bytes since boot
+ */
+uint32_t msg_entry_dropped() {
+  return _msg.dropped;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file msg_entry.h
+ */
+
+#ifndef MSG_ENTRY_H
+#define MSG_ENTRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+void msg_entry_reset();
+
+bool msg_entry_push_bit(uint8_t bit);
+
+bool msg_entry_push_byte(uint8_t byte);
+
+void msg_entry_clear_partial();
+
+void msg_entry_truncate(uint16_t len);
+
+uint16_t msg_entry_len();
+
+uint8_t msg_entry_partial_bits();
+
+uint8_t msg_entry_peek(uint16_t index);
+
+uint32_t msg_entry_dropped();
+
+#endif // MSG_ENTRY_H
@@ -2,51 +2,103 @@
  * @file my_state_machine.c
  */
 
+ #include <inttypes.h>
  #include <zephyr/smf.h>
+ #include <zephyr/logging/log.h>
  #include "LED.h"
  #include "my_state_machine.h"
  #include "BTN.h"
+ #include "app_event.h"
+ #include "ble_broadcast.h"
+ #include "ble_service.h"
+ #include "boot_prof.h"
+ #include "deferred.h"
+ #include "msg_entry.h"
+ #include "persist.h"
+ #include "sm_table.h"
+ #include "sm_trace.h"
+ #include "uart_input.h"
 
- #define ASCIILEN 16
  #define BTN01_MASK ((1 << 0) | (1 << 1)) /* for convenience */
- #define sleep_time 5
+ #define BIT_FLASH_MS 5 /* LED0/LED1 flash this long to show a bit was entered */
+ #define ALL_LEDS BIT_MASK(NUM_LEDS)
+ #define ON LED_MAX_DUTY_CYCLE
+ #define STANDBY_BREATHE_MS 2000 /* one full dim -> bright -> dim cycle */
+ #define STANDBY_HOLD_MS 3000 /* BTN0 + BTN1 held this long enters standby */
+ #define MSG_CHARS CONFIG_APP_MSG_CHARS /* 0 for messages of any length */
+ #define ENTRYA_CHARS 1 /* ENTRYA takes the first character, ENTRYB the rest */
+ #define MORSE_LED LED2 /* flashes the decoded message */
+ #define MORSE_UNIT_MS 150 /* one dot */
+ #define MORSE_MAX_STEPS 128 /* two per symbol, longer messages are cut short */
+
+ BUILD_ASSERT(MSG_CHARS <= CONFIG_APP_MSG_RING_SIZE, "the whole message has to fit in the ring");
+
+ LOG_MODULE_DECLARE(app, CONFIG_APP_LOG_LEVEL);
 
   /* --------------------------------------------------------------------------------------------------------------
-  Global Static Password Manager (Using Malloc for a variable array length as well)
+  Message Entry, Bits Are Packed into Characters by msg_entry as They Arrive
  -------------------------------------------------------------------------------------------------------------- */
 
- static int half_len = ASCIILEN / 2;
- static int user_input[ASCIILEN];
- static int64_t standby_hold_start = -1;
+ //true while the character in progress would still fit in a message of max_chars (0 for no limit)
+ static bool msg_has_room(uint16_t max_chars){
+  return 0 == max_chars || msg_entry_len() < max_chars;
+ }
 
- void clear_input(int start){
-  for (int i = start; i < half_len + start; i++){
-    user_input[i] = -1;
-  }
+
+ /* --------------------------------------------------------------------------------------------------------------
+   Update LEDs as One Frame, Applied in One Pass of the LED Owner
+ -------------------------------------------------------------------------------------------------------------- */
+
+ static void set_leds(uint32_t mask, uint8_t led0, uint8_t led1, uint8_t led2, uint8_t led3){
+  const uint8_t duty[NUM_LEDS] = {led0, led1, led2, led3};
+  LED_frame_set(mask, duty);
+  LED_frame_commit();
+ }
+
+ static void led_off(uint32_t led){
+  LED_set(led, LED_OFF);
+ }
+
+ static void flash_led(led_id led){
+  LED_set(led, LED_ON);
+  deferred_schedule(led_off, led, BIT_FLASH_MS); //turned off later so the run state never sleeps
+ }
+
+ static void enter_bit(led_id led, uint8_t bit){
+  flash_led(led);
+  msg_entry_push_bit(bit);
  }
 
  /* --------------------------------------------------------------------------------------------------------------
    Map Buttons to Return Values for Edge Detection
  -------------------------------------------------------------------------------------------------------------- */
 
+ //the BTN driver keeps the debounced state of every button, reading it is a single load
  int button_press(){
-  uint16_t mask = 0;
+  return BTN_get_mask();
+ }
 
-  if (BTN_is_pressed(BTN0)) mask |= (1 << 0);
-  if (BTN_is_pressed(BTN1)) mask |= (1 << 1);
-  if (BTN_is_pressed(BTN2)) mask |= (1 << 2);
-  if (BTN_is_pressed(BTN3)) mask |= (1 << 3);
+ /* --------------------------------------------------------------------------------------------------------------
+   Gestures Recognized by the BTN Driver
+ -------------------------------------------------------------------------------------------------------------- */
 
-  return mask;
- }
+ enum {
+  GESTURE_STANDBY,
+ };
 
- static int last_button = 0;
+ static const btn_gesture gestures[] = {
+  [GESTURE_STANDBY] = {.type=BTN_GESTURE_CHORD, .mask=BTN01_MASK, .time_ms=STANDBY_HOLD_MS},
+ };
+
+ static atomic_t pending_gestures = ATOMIC_INIT(0); //set from the system workqueue, taken by the run states
+
+ static void on_gesture(uint8_t gesture){
+  atomic_set_bit(&pending_gestures, gesture);
+  app_event_post(APP_EVENT_GESTURE, gesture);
+ }
 
- static int button_press_edge(){
-  int current = button_press();
-  int edge = current & ~last_button;
-  last_button = current;
-  return edge; 
+ static bool gesture_taken(int gesture){
+  return atomic_test_and_clear_bit(&pending_gestures, gesture);
  }
 
  /* --------------------------------------------------------------------------------------------------------------
@@ -54,288 +106,308 @@
  -------------------------------------------------------------------------------------------------------------- */
 
  //Using Entry States for LED Control
+ static void active_entry(void * o);
  static void entrya_entry(void * o);
  static void entryb_entry(void * o);
  static void end_entry(void * o);
  static void standby_entry(void * o);
 
- // Using Run States to wait for state shifting
- static enum smf_state_result entrya_run(void *o);
- static enum smf_state_result entryb_run(void *o);
- static enum smf_state_result end_run(void *o);
- static enum smf_state_result standby_run(void *o);
+ //Every state runs the transition table, so there is one run function
+ static enum smf_state_result table_run(void *o);
 
  /* --------------------------------------------------------------------------------------------------------------
-   Names of States
+   Names of States and Events
  -------------------------------------------------------------------------------------------------------------- */
  enum {
   ENTRYA,  
   ENTRYB,
   END,
-  STANDBY   
+  STANDBY,
+  ACTIVE, //parent of ENTRYA, ENTRYB and END, never the current state itself
+  NUM_STATES
 }; 
 
+ //Button events share their number with the button
+ enum {
+  EV_BTN0,
+  EV_BTN1,
+  EV_BTN2,
+  EV_BTN3,
+  EV_STANDBY, //BTN0 + BTN1 held for STANDBY_HOLD_MS
+  NUM_EVENTS
+ };
+
+ BUILD_ASSERT((int)EV_BTN3 == (int)BTN3, "button events are the btn_id of the press");
+ BUILD_ASSERT(NUM_BTNS > BTN3 && NUM_LEDS > LED3, "the machine uses four buttons and four LEDs, extra ones are ignored");
+
  //Needed to monitor current state
  typedef struct {
    struct smf_ctx ctx;
-   uint16_t input_count;
-   uint16_t last_state;
-   uint16_t pwm;
+   uint16_t last_state; //where SM_HISTORY goes
+   uint8_t event; //the one event this run handles
  } state_object_t;
 
  static state_object_t state_object; //creating state_object to monitor and change states
 
-
  /* --------------------------------------------------------------------------------------------------------------
-   Define State Table
+   Guards and Actions Used by the Transition Table
  -------------------------------------------------------------------------------------------------------------- */
 
- const struct smf_state state_machine_states[] = {
-   [ENTRYA] = SMF_CREATE_STATE(entrya_entry, entrya_run, NULL, NULL, NULL),
-   [ENTRYB] = SMF_CREATE_STATE(entryb_entry, entryb_run, NULL, NULL, NULL),
-   [END] = SMF_CREATE_STATE(end_entry, end_run, NULL, NULL, NULL),
-   [STANDBY] = SMF_CREATE_STATE(standby_entry, standby_run, NULL, NULL, NULL)
- };
-
- /* --------------------------------------------------------------------------------------------------------------
-   Initialize and Run
- -------------------------------------------------------------------------------------------------------------- */
- void state_machine_init(){
-   state_object.last_state = ENTRYA;
-   smf_set_initial(SMF_CTX(&state_object), &state_machine_states[ENTRYA]);
+ static bool first_char_open(){
+  return msg_has_room(ENTRYA_CHARS);
  }
 
- int state_machine_run(){
-   return smf_run_state(SMF_CTX(&state_object));
+ static bool first_char_complete(){
+  return msg_entry_len() >= ENTRYA_CHARS && 0 == msg_entry_partial_bits();
  }
 
- /* --------------------------------------------------------------------------------------------------------------
-   Entry States
- -------------------------------------------------------------------------------------------------------------- */
- static void entrya_entry(void * o){
-  state_object.last_state = ENTRYA;
-  state_object.input_count = 0;
-  clear_input(0);
-  LED_set(LED0, LED_OFF);
-  LED_set(LED1, LED_OFF);
-  LED_set(LED2, LED_OFF);
-  LED_set(LED3, LED_ON);
-  LED_blink(LED3, 1);
+ static bool rest_open(){
+  return msg_has_room(MSG_CHARS);
  }
 
- static void entryb_entry(void * o){
-  state_object.last_state = ENTRYB;
-  clear_input(8);
-  LED_set(LED0, LED_OFF);
-  LED_set(LED1, LED_OFF);
-  LED_set(LED2, LED_OFF);
-  LED_set(LED3, LED_ON);
-  LED_blink(LED3, 4);
+ static bool message_complete(){
+  uint16_t len = msg_entry_len();
+  return 0 != len && 0 == msg_entry_partial_bits() && (0 == MSG_CHARS || MSG_CHARS == len);
  }
 
- static void end_entry(void * o){
-  state_object.last_state = END;
-  state_object.input_count = 0;
-  LED_set(LED0, LED_OFF);
-  LED_set(LED1, LED_OFF);
-  LED_set(LED2, LED_OFF);
-  LED_set(LED3, LED_ON);
-  LED_blink(LED3, 16);
+ static void enter_zero(){
+  enter_bit(LED0, 0);
  }
 
- static void standby_entry(void * o){
-  state_object.pwm = 0;
-  LED_set(LED0, LED_ON);
-  LED_set(LED1, LED_ON);
-  LED_set(LED2, LED_ON);
-  LED_set(LED3, LED_ON);
+ static void enter_one(){
+  enter_bit(LED1, 1);
  }
 
- /* --------------------------------------------------------------------------------------------------------------
-   Run States
- -------------------------------------------------------------------------------------------------------------- */
-
- static enum smf_state_result entrya_run(void *o){
-  int press = button_press();
-  int64_t current_time = k_uptime_get();
-  
-  LED_set(LED0, LED_OFF);
-  LED_set(LED1, LED_OFF);
-
-  if ((press & BTN01_MASK) == BTN01_MASK){
-    if (standby_hold_start < 0){
-      standby_hold_start = current_time; //set current time to find diff
-    } else if ((current_time - standby_hold_start >= 3000)){
-      standby_hold_start = -1;
-      smf_set_state(SMF_CTX(&state_object), &state_machine_states[STANDBY]);
-    } 
-  } else {
-    standby_hold_start = -1;
-  }
+ //two buffers, so the message being encoded is never the one MORSE_LED is still playing
+ static led_step morse_steps[2][MORSE_MAX_STEPS];
+ static led_pattern morse_pattern[2];
+ static uint8_t morse_buffer = 0;
 
-  int edge = button_press_edge();
-  if (edge != 0){
+ //played by the LED driver's timer, the state machine doesn't wait for it
+ static void flash_message(const char *chars){
+  morse_buffer ^= 1;
+  morse_pattern[morse_buffer].steps = morse_steps[morse_buffer];
+  morse_pattern[morse_buffer].count = LED_morse(chars, MORSE_UNIT_MS, morse_steps[morse_buffer], MORSE_MAX_STEPS);
+  morse_pattern[morse_buffer].loop = false;
 
-    if ((edge & (1 << 0)) && (state_object.input_count < half_len)){
-      LED_set(LED0, LED_ON);
-      k_msleep(sleep_time); //added for visibility
-      user_input[state_object.input_count++] = 0;
-    }
+  if (morse_pattern[morse_buffer].count){
+    LED_play(MORSE_LED, &morse_pattern[morse_buffer]);
+  }
+ }
 
-    if ((edge & (1 << 1)) && (state_object.input_count < half_len)){
-      LED_set(LED1, LED_ON);
-      k_msleep(sleep_time); //added for visibility
-      user_input[state_object.input_count++] = 1;
-    }
+ static uint32_t reported_drops = 0; //msg_entry_dropped() at the last printout
 
-    if (edge & (1 << 2)){
-      clear_input(0);
-      state_object.input_count = 0;
-    }
+ static void print_message(){
+  //characters were decoded as their 8th bit arrived, only joining them up is left
+  char text[CONFIG_APP_MSG_RING_SIZE * 3]; //"c, " per character, the last ", " holds the terminator
+  char chars[CONFIG_APP_MSG_RING_SIZE + 1];
+  char *end = text;
+  uint16_t len = msg_entry_len();
 
-    if (edge & (1 << 3)){
-      smf_set_state(SMF_CTX(&state_object), &state_machine_states[ENTRYB]);
+  for (uint16_t i = 0; i < len; i++){
+    if (i){
+      *end++ = ',';
+      *end++ = ' ';
     }
-
+    *end++ = msg_entry_peek(i);
+    chars[i] = msg_entry_peek(i);
+    ble_service_char(msg_entry_peek(i));
   }
-
-
-  return SMF_EVENT_HANDLED;
+  *end = '\0';
+  chars[len] = '\0';
+
+  //deferred, the log thread does the formatting and the UART wait
+  LOG_INF("Characters %s", text);
+  if (msg_entry_dropped() != reported_drops){
+    LOG_WRN("%" PRIu32 " characters didn't fit in the message ring and were dropped", msg_entry_dropped() - reported_drops);
+    reported_drops = msg_entry_dropped();
+  }
+  uart_input_reply(chars, len);
+  flash_message(chars);
  }
 
- static enum smf_state_result entryb_run(void *o){
-  int press = button_press();
-  int64_t current_time = k_uptime_get();
-  
-  LED_set(LED0, LED_OFF);
-  LED_set(LED1, LED_OFF);
-
-  if ((press & BTN01_MASK) == BTN01_MASK){
-    if (standby_hold_start < 0){
-      standby_hold_start = current_time; //set current time to find diff
-    } else if ((current_time - standby_hold_start >= 3000)){
-      standby_hold_start = -1;
-      smf_set_state(SMF_CTX(&state_object), &state_machine_states[STANDBY]);
-    } 
-  } else {
-    standby_hold_start = -1;
+ //posted through APP_EVENT_DRIVER once the LED driver has played a pattern to its end
+ void state_machine_led_done(uint8_t led){
+  if (MORSE_LED == led){
+    LOG_INF("Message flashed");
   }
+ }
 
+ static void print_entry_error(){
+  LOG_ERR("Error when entering ASCII code, resetting. Please re-enter the code correctly (8 bits per character)");
+ }
 
-  int edge = button_press_edge();
-  if (edge != 0){
-
-    if ((edge & (1 << 0)) && (state_object.input_count < ASCIILEN)){
-      LED_set(LED0, LED_ON);
-      k_msleep(sleep_time); //added for visibility
-      user_input[state_object.input_count++] = 0;
-    }
-
-    if ((edge & (1 << 1)) && (state_object.input_count < ASCIILEN)){
-      LED_set(LED1, LED_ON);
-      k_msleep(sleep_time); //added for visibility
-      user_input[state_object.input_count++] = 1;
-    }
+ /* --------------------------------------------------------------------------------------------------------------
+   Transition Table, One Row per (state, event, guard, next, action)
+   Events a child has no row for, or whose guard fails, go to its parent
+ -------------------------------------------------------------------------------------------------------------- */
 
-    if (edge & (1 << 2)){
-      clear_input(8);
-      state_object.input_count = 8;
-    }
+ #define TRANSITIONS(X) \
+  X(ENTRYA,  EV_BTN0,    first_char_open,     SM_STAY,    enter_zero) \
+  X(ENTRYA,  EV_BTN1,    first_char_open,     SM_STAY,    enter_one) \
+  X(ENTRYA,  EV_BTN3,    first_char_complete, ENTRYB,     NULL) \
+  X(ENTRYB,  EV_BTN0,    rest_open,           SM_STAY,    enter_zero) \
+  X(ENTRYB,  EV_BTN1,    rest_open,           SM_STAY,    enter_one) \
+  X(ENTRYB,  EV_BTN2,    NULL,                ENTRYB,     NULL) /* only clears what ENTRYB took in */ \
+  X(ENTRYB,  EV_BTN3,    NULL,                END,        NULL) \
+  X(END,     EV_BTN3,    message_complete,    SM_STAY,    print_message) \
+  X(ACTIVE,  EV_BTN2,    NULL,                ENTRYA,     NULL) \
+  X(ACTIVE,  EV_BTN3,    NULL,                ENTRYA,     print_entry_error) /* ENTRYA or END with an incomplete message */ \
+  X(ACTIVE,  EV_STANDBY, NULL,                STANDBY,    NULL) \
+  X(STANDBY, EV_BTN0,    NULL,                SM_HISTORY, NULL) \
+  X(STANDBY, EV_BTN1,    NULL,                SM_HISTORY, NULL) \
+  X(STANDBY, EV_BTN2,    NULL,                SM_HISTORY, NULL) \
+  X(STANDBY, EV_BTN3,    NULL,                SM_HISTORY, NULL)
+
+ static const sm_row transitions[NUM_STATES][NUM_EVENTS] = {
+  TRANSITIONS(SM_ROW)
+ };
 
-    if (edge & (1 << 3)){
-      smf_set_state(SMF_CTX(&state_object), &state_machine_states[END]);
-    }
+ /* --------------------------------------------------------------------------------------------------------------
+   Define State Table
+ -------------------------------------------------------------------------------------------------------------- */
 
-  }
+ const struct smf_state state_machine_states[] = {
+   [ENTRYA] = SMF_CREATE_STATE(entrya_entry, table_run, NULL, &state_machine_states[ACTIVE], NULL),
+   [ENTRYB] = SMF_CREATE_STATE(entryb_entry, table_run, NULL, &state_machine_states[ACTIVE], NULL),
+   [END] = SMF_CREATE_STATE(end_entry, table_run, NULL, &state_machine_states[ACTIVE], NULL),
+   [STANDBY] = SMF_CREATE_STATE(standby_entry, table_run, NULL, NULL, NULL),
+   [ACTIVE] = SMF_CREATE_STATE(active_entry, NULL, NULL, NULL, NULL)
+ };
 
+ static const char *const state_names[] = {
+   [ENTRYA] = "ENTRYA",
+   [ENTRYB] = "ENTRYB",
+   [END] = "END",
+   [STANDBY] = "STANDBY",
+   [ACTIVE] = "ACTIVE"
+ };
 
-  return SMF_EVENT_HANDLED;
+ static uint8_t current_state(){
+   return SMF_CTX(&state_object)->current - state_machine_states;
  }
 
- static enum smf_state_result end_run(void *o){
-  int press = button_press();
-  int64_t current_time = k_uptime_get();
-
-  if ((press & BTN01_MASK) == BTN01_MASK){
-    if (standby_hold_start < 0){
-      standby_hold_start = current_time; //set current time to find diff
-    } else if ((current_time - standby_hold_start >= 3000)){
-      standby_hold_start = -1;
-      smf_set_state(SMF_CTX(&state_object), &state_machine_states[STANDBY]);
-    } 
-  } else {
-    standby_hold_start = -1;
-  }
-
+ //Every transition goes through here so it can be traced
+ static void set_state(uint8_t next){
+   sm_trace_transition(current_state(), next);
+   ble_service_state(next);
+   smf_set_state(SMF_CTX(&state_object), &state_machine_states[next]);
+ }
 
-  int edge = button_press_edge();
-  
-  if (edge != 0){
-    if (edge & (1 << 2)){
-      clear_input(0);
-      clear_input(8);
-      smf_set_state(SMF_CTX(&state_object), &state_machine_states[ENTRYA]);
+ //Finds the row for the event in the state or its nearest ancestor that has one
+ static void dispatch(uint8_t event){
+  for (const struct smf_state *s = SMF_CTX(&state_object)->current; s != NULL; s = s->parent){
+    const sm_row *row = sm_table_find(&transitions[0][0], NUM_EVENTS, s - state_machine_states, event);
+    if (row == NULL){
+      continue;
     }
 
-    if (edge & (1 << 3)){
-      for (int i = 0; i < ASCIILEN; i++){
-        if (user_input[i] == -1){
-          printk("Error when entering ASCII code, resetting. Please re-enter the code correctly (8 bits & 8 bits)\n");
-          smf_set_state(SMF_CTX(&state_object), &state_machine_states[ENTRYA]);
-          return SMF_EVENT_HANDLED;
-        }
-      }
-
-      uint16_t first = 0;
-      uint16_t second = 0;
-
-      for (int i = 0; i < 8; i++){
-        first = (first << 1) | (user_input[i] & 1);
-      }
-
-      for (int i = 8; i < 16; i++){
-        second = (second << 1) | (user_input[i] & 1);
-      }
-      printk("Characters %c, %c ", first, second);
+    if (row->action){
+      row->action();
+    }
+    if (row->next != SM_STAY){
+      set_state(row->next == SM_HISTORY ? state_object.last_state : row->next);
     }
+    return;
   }
-  
+ }
 
-  return SMF_EVENT_HANDLED;
+ /* --------------------------------------------------------------------------------------------------------------
+   Initialize and Run
+ -------------------------------------------------------------------------------------------------------------- */
+ void state_machine_init(){
+   sm_trace_set_names(state_names, ARRAY_SIZE(state_names));
+   BTN_gesture_register(gestures, ARRAY_SIZE(gestures), on_gesture);
+   //pick up where a reset left off, entries that don't name an entry state start over
+   int restored = persist_last_state();
+   uint8_t initial = (ENTRYB == restored || END == restored) ? restored : ENTRYA;
+
+   state_object.last_state = initial;
+   ble_service_state(initial);
+   smf_set_initial(SMF_CTX(&state_object), &state_machine_states[initial]);
+
+   //the entry actions just cleared the message, put back what was entered before the reset
+   uint8_t chars[CONFIG_APP_MSG_RING_SIZE];
+   uint16_t len = persist_message(chars, sizeof(chars));
+   for (uint16_t i = 0; i < len; i++){
+     msg_entry_push_byte(chars[i]);
+   }
  }
 
- static enum smf_state_result standby_run(void *o){
+ //one pass through the current state with a single event, traced as one run
+ static int run_event(uint8_t event){
+   uint8_t state = current_state();
+   uint32_t start = sm_trace_run_begin();
+   state_object.event = event;
+   int ret = smf_run_state(SMF_CTX(&state_object));
+   sm_trace_run_end(state, start);
+   return ret;
+ }
 
-  int edge = button_press_edge();
+ int state_machine_run(){
+   btn_event evt;
+   int ret = 0;
+
+   //every queued press is dispatched on its own, in the order the buttons were pressed, so
+   //a press that changes state never hides the ones behind it
+   while (0 == ret && 0 == BTN_get_event(&evt)){
+     if (BTN_EDGE_PRESS != evt.edge || evt.btn > EV_BTN3){
+       continue;
+     }
+     ret = run_event(evt.btn);
+     app_event_count_latency(evt.timestamp);
+     boot_prof_mark(BOOT_PHASE_FIRST_INPUT); //logs the boot report the first time
+   }
+   //taken in every state, so holding the chord again in standby doesn't re-enter it on the way out
+   if (0 == ret && gesture_taken(GESTURE_STANDBY)){
+     ret = run_event(EV_STANDBY);
+   }
+   uart_input_taken(); //the queue is empty now, the UART input can fill it again
+
+   boot_prof_mark(BOOT_PHASE_FIRST_RUN); //only the first one counts
+   ble_broadcast_update(current_state()); //only goes on air if something changed
+   persist_update(state_object.last_state); //only armed if something changed
+   return ret;
+ }
 
-  if (edge != 0){
-    state_object.pwm = 0;
-    smf_set_state(SMF_CTX(&state_object), &state_machine_states[state_object.last_state]);
-    return SMF_EVENT_HANDLED;
-  }
+ /* --------------------------------------------------------------------------------------------------------------
+   Entry States
+ -------------------------------------------------------------------------------------------------------------- */
+ //Only runs when coming in from STANDBY (or at boot), moving between the children keeps the LEDs as they are
+ static void active_entry(void * o){
+  set_leds(ALL_LEDS, 0, 0, 0, ON);
+ }
 
-  static int pwm_direction = 1; //needs to persist between calls otherwise gets stuck at pwm 100
+ static void entrya_entry(void * o){
+  state_object.last_state = ENTRYA;
+  msg_entry_reset();
+  LED_blink(LED3, 1);
+ }
+
+ static void entryb_entry(void * o){
+  state_object.last_state = ENTRYB;
+  msg_entry_truncate(ENTRYA_CHARS); //an unfinished first character is dropped rather than continued here
+  LED_blink(LED3, 4);
+ }
 
-  state_object.pwm += pwm_direction * 5;
+ static void end_entry(void * o){
+  state_object.last_state = END;
+  LED_blink(LED3, 16);
+ }
 
-  if (state_object.pwm >= 100) {
-      state_object.pwm = 100;
-      pwm_direction = -1;
-  } 
-  else if (state_object.pwm <= 0) {
-      state_object.pwm = 0;
-      pwm_direction = 1;
+ static void standby_entry(void * o){
+  deferred_cancel_all(); //a pending flash would otherwise stop its LED breathing
+  //breathing runs in the LED driver, so standby needs no re-runs of its own
+  for (int i = 0; i < NUM_LEDS; i++){
+    LED_breathe(i, 0, ON, STANDBY_BREATHE_MS, LED_CURVE_GAMMA);
   }
+ }
 
-  LED_pwm(LED0, state_object.pwm);
-  LED_pwm(LED1, state_object.pwm);
-  LED_pwm(LED2, state_object.pwm);
-  LED_pwm(LED3, state_object.pwm);
-
-  k_msleep(sleep_time * 10);
+ /* --------------------------------------------------------------------------------------------------------------
+   Run State, Feeds This Run's Event Through the Transition Table
+ -------------------------------------------------------------------------------------------------------------- */
 
+ static enum smf_state_result table_run(void *o){
+  dispatch(state_object.event);
   return SMF_EVENT_HANDLED;
  }
-
-
-
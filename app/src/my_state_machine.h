@@ -5,7 +5,10 @@
  #ifndef MY_STATE_MACHINE_H
  #define MY_STATE_MACHINE_H
 
+ #include <stdint.h>
+
  void state_machine_init();
  int state_machine_run();
+ void state_machine_led_done(uint8_t led);
 
  #endif // MY_STATE_MACHINE_H
\ No newline at end of file
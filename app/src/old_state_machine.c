@@ -6,6 +6,7 @@
  #include "LED.h"
  #include "my_state_machine.h"
  #include "BTN.h"
+ #include "sm_table.h"
 
  /* --------------------------------------------------------------------------------------------------------------
    Map Buttons to Return Values for Edge Detection
@@ -44,22 +45,28 @@
  static void s3_state_entry(void * o);
  static void s4_state_entry(void * o);
 
- // Using Run States to wait for button presses to shift between states as per the diagaram
- static enum smf_state_result s0_state_run(void *o);
- static enum smf_state_result s1_state_run(void *o);
- static enum smf_state_result s2_state_run(void *o);
- static enum smf_state_result s3_state_run(void *o);
- static enum smf_state_result s4_state_run(void *o);
+ // Every state shifts as per the diagram through the transition table, so there is one run function
+ static enum smf_state_result table_run(void *o);
 
  /* --------------------------------------------------------------------------------------------------------------
-   Names of States
+   Names of States and Events
  -------------------------------------------------------------------------------------------------------------- */
  enum state_machine_states{
     S0,
     S1,
     S2,
     S3,
-    S4
+    S4,
+    NUM_STATES
+ };
+
+ enum state_machine_events{
+    EV_BTN0, //button_press_edge() == 1
+    EV_BTN1,
+    EV_BTN2,
+    EV_BTN3,
+    EV_TICK, //a run without a new press
+    NUM_EVENTS
  };
 
  //Needed to monitor current state
@@ -71,16 +78,67 @@
 
  static state_object_t state_object;
 
+ /* --------------------------------------------------------------------------------------------------------------
+   Guards and Actions Used by the Transition Table
+ -------------------------------------------------------------------------------------------------------------- */
+
+ //Counts ticks, passes (and starts counting again) once more than limit have gone by
+ static bool ticks_over(uint16_t limit){
+  if (state_object.count > limit){
+    state_object.count = 0;
+    return true;
+  }
+  state_object.count++;
+  return false;
+ }
+
+ static bool after_33(){ return ticks_over(33); }
+ static bool after_500(){ return ticks_over(500); }
+ static bool after_1000(){ return ticks_over(1000); }
+ static bool after_2000(){ return ticks_over(2000); }
+
+ static void toggle_led0(){
+  LED_toggle(LED0);
+ }
+
+ static void toggle_all(){
+  LED_toggle(LED0);
+  LED_toggle(LED1);
+  LED_toggle(LED2);
+  LED_toggle(LED3);
+ }
+
+ /* --------------------------------------------------------------------------------------------------------------
+   Transition Table, One Row per (state, event, guard, next, action)
+ -------------------------------------------------------------------------------------------------------------- */
+
+ #define TRANSITIONS(X) \
+  X(S0, EV_BTN0, NULL,       S1,      NULL) \
+  X(S1, EV_BTN1, NULL,       S2,      NULL) \
+  X(S1, EV_BTN2, NULL,       S4,      NULL) \
+  X(S1, EV_BTN3, NULL,       S0,      NULL) \
+  X(S1, EV_TICK, after_500,  SM_STAY, toggle_led0) \
+  X(S2, EV_BTN3, NULL,       S0,      NULL) \
+  X(S2, EV_TICK, after_1000, S3,      NULL) \
+  X(S3, EV_BTN3, NULL,       S0,      NULL) \
+  X(S3, EV_TICK, after_2000, S2,      NULL) \
+  X(S4, EV_BTN3, NULL,       S0,      NULL) \
+  X(S4, EV_TICK, after_33,   SM_STAY, toggle_all)
+
+ static const sm_row transitions[NUM_STATES][NUM_EVENTS] = {
+  TRANSITIONS(SM_ROW)
+ };
+
  /* --------------------------------------------------------------------------------------------------------------
    Define State Table
  -------------------------------------------------------------------------------------------------------------- */
 
  const struct smf_state state_machine_states[] = {
-   [S0] = SMF_CREATE_STATE(s0_state_entry, s0_state_run, NULL, NULL, NULL),
-   [S1] = SMF_CREATE_STATE(s1_state_entry, s1_state_run, NULL, NULL, NULL),
-   [S2] = SMF_CREATE_STATE(s2_state_entry, s2_state_run, NULL, NULL, NULL),
-   [S3] = SMF_CREATE_STATE(s3_state_entry, s3_state_run, NULL, NULL, NULL),
-   [S4] = SMF_CREATE_STATE(s4_state_entry, s4_state_run, NULL, NULL, NULL)
+   [S0] = SMF_CREATE_STATE(s0_state_entry, table_run, NULL, NULL, NULL),
+   [S1] = SMF_CREATE_STATE(s1_state_entry, table_run, NULL, NULL, NULL),
+   [S2] = SMF_CREATE_STATE(s2_state_entry, table_run, NULL, NULL, NULL),
+   [S3] = SMF_CREATE_STATE(s3_state_entry, table_run, NULL, NULL, NULL),
+   [S4] = SMF_CREATE_STATE(s4_state_entry, table_run, NULL, NULL, NULL)
  };
 
  /* --------------------------------------------------------------------------------------------------------------
@@ -140,83 +198,24 @@
  }
 
  /* --------------------------------------------------------------------------------------------------------------
-   Run States
+   Run State
  -------------------------------------------------------------------------------------------------------------- */
 
- static enum smf_state_result s0_state_run(void *o){
+ static enum smf_state_result table_run(void *o){
   int edge = button_press_edge();
-  //switch states
-  if (edge == 1) {
-    smf_set_state(SMF_CTX(&state_object), &state_machine_states[S1]);
-  }
-  return SMF_EVENT_HANDLED;
- }
+  uint8_t event = (edge == -1) ? EV_TICK : EV_BTN0 + edge - 1;
+  uint8_t state = SMF_CTX(&state_object)->current - state_machine_states;
 
- static enum smf_state_result s1_state_run(void *o){
-  int edge = button_press_edge();
-  if (edge == 4) smf_set_state(SMF_CTX(&state_object), &state_machine_states[S0]);
-  if (edge == 3) smf_set_state(SMF_CTX(&state_object), &state_machine_states[S4]);
-  if (edge == 2) smf_set_state(SMF_CTX(&state_object), &state_machine_states[S2]);
-
-  if (edge == -1){
-    if (state_object.count > 500){
-      LED_toggle(LED0);
-      state_object.count = 0;
-    } else {
-      state_object.count++;
-    }
+  const sm_row *row = sm_table_find(&transitions[0][0], NUM_EVENTS, state, event);
+  if (row == NULL){
+    return SMF_EVENT_HANDLED;
   }
-  return SMF_EVENT_HANDLED;
- }
-
- static enum smf_state_result s2_state_run(void *o){
-  int edge = button_press_edge();
-  if (edge == 4) smf_set_state(SMF_CTX(&state_object), &state_machine_states[S0]);
-
-  if (edge == -1){
-    if (state_object.count > 1000){
-      state_object.count = 0;
-      smf_set_state(SMF_CTX(&state_object), &state_machine_states[S3]);
-    } else {
-      state_object.count++;
-    }
-  }
-
-  return SMF_EVENT_HANDLED;
- }
 
- static enum smf_state_result s3_state_run(void *o){
-  int edge = button_press_edge();
-  if (edge == 4) smf_set_state(SMF_CTX(&state_object), &state_machine_states[S0]);
-
-  if (edge == -1){
-    if (state_object.count > 2000){
-      state_object.count = 0;
-      smf_set_state(SMF_CTX(&state_object), &state_machine_states[S2]);
-    } else {
-      state_object.count++;
-    }
+  if (row->action){
+    row->action();
   }
-  
-  return SMF_EVENT_HANDLED;
- }
-
- static enum smf_state_result s4_state_run(void *o){
-  int edge = button_press_edge();
-  if (edge == 4) smf_set_state(SMF_CTX(&state_object), &state_machine_states[S0]);
-
-  if (edge == -1){
-    if (state_object.count > 33) {
-      LED_toggle(LED0);
-      LED_toggle(LED1);
-      LED_toggle(LED2);
-      LED_toggle(LED3);
-      state_object.count = 0;
-    } else {
-      state_object.count++;
-    }
+  if (row->next != SM_STAY){
+    smf_set_state(SMF_CTX(&state_object), &state_machine_states[row->next]);
   }
-
   return SMF_EVENT_HANDLED;
  }
-
@@ -0,0 +1,267 @@
+/**
+ * @file persist.c
+ *
+ * The message and the state it was entered in are stored as two settings entries,
+ * "app/state" and "app/msg". After every state machine run the current values are compared
+ * with the ones waiting to be written, and a change arms a write CONFIG_APP_PERSIST_INTERVAL_MS
+ * later. Changes that arrive while a write is armed join it, so any burst of input costs at
+ * most one write of each entry per interval, and an entry that ends up where it started
+ * isn't written at all.
+ */
+
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <inttypes.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/logging/log.h>
+
+#include "msg_entry.h"
+#include "persist.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define PERSIST_TREE          "app"
+#define PERSIST_KEY_STATE     "state"
+#define PERSIST_KEY_MSG       "msg"
+#define PERSIST_MS_PER_HOUR   3600000ULL
+
+LOG_MODULE_DECLARE(app, CONFIG_APP_LOG_LEVEL);
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+typedef struct persist_record_t {
+  int16_t state; // -ENOENT until one is stored or restored
+  uint16_t len;
+  uint8_t chars[CONFIG_APP_MSG_RING_SIZE];
+} persist_record;
+
+/*
+ * pending is written from the main thread and drained from the system workqueue,
+ * stored is only touched by the workqueue once boot is over
+ */
+typedef struct persist_t {
+  struct k_spinlock lock;
+  persist_record pending; // Latest values, written at the next flush
+  persist_record stored; // What flash holds
+  persist_stats stats;
+  struct k_work_delayable flush;
+} persist;
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static bool _persist_same_msg(const persist_record *a, const persist_record *b);
+
+static int _persist_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg);
+
+static void _persist_count(const char *name, size_t len);
+
+static void _persist_flush(struct k_work *work);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+SETTINGS_STATIC_HANDLER_DEFINE(_persist_handler, PERSIST_TREE, NULL, _persist_set, NULL, NULL);
+
+static persist _persist = {
+  .pending={.state=-ENOENT, .len=0},
+  .stored={.state=-ENOENT, .len=0},
+};
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Compares the messages of two records
+ *
+ * @return true if they hold the same characters
+ */
+static bool _persist_same_msg(const persist_record *a, const persist_record *b) {
+  return a->len == b->len && 0 == memcmp(a->chars, b->chars, a->len);
+}
+
+/**
+ * @brief Settings handler, restores one entry of the "app" tree while it is loaded at boot.
+ *        Entries that don't fit what this build expects are ignored
+ *
+ * @param [in] name Key below "app"
+ * @param [in] len Size of the stored value
+ * @param [in] read_cb Reads the value
+ * @param [in] cb_arg Argument for read_cb
+ *
+ * @return Error code, < 0 on failures
+ */
+static int _persist_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg) {
+  const char *next;
+
+  if (settings_name_steq(name, PERSIST_KEY_STATE, &next) && !next) {
+    uint8_t state;
+    if (sizeof(state) == len && sizeof(state) == read_cb(cb_arg, &state, sizeof(state))) {
+      _persist.stored.state = state;
+    }
+    return 0;
+  }
+
+  if (settings_name_steq(name, PERSIST_KEY_MSG, &next) && !next) {
+    if (len <= sizeof(_persist.stored.chars)) {
+      ssize_t rv = read_cb(cb_arg, _persist.stored.chars, len);
+      _persist.stored.len = (rv > 0) ? rv : 0;
+    }
+    return 0;
+  }
+
+  return -ENOENT;
+}
+
+/**
+ * @brief Adds a write to the statistics and logs the rate when enabled
+ *
+ * @param [in] name Full settings key that was written
+ * @param [in] len Size of the value written, 0 for a delete
+ */
+static void _persist_count(const char *name, size_t len) {
+  uint64_t uptime_ms = MAX(k_uptime_get(), 1);
+
+  _persist.stats.writes++;
+  _persist.stats.bytes += strlen(name) + len;
+  _persist.stats.bytes_per_hour = (uint32_t)((_persist.stats.bytes * PERSIST_MS_PER_HOUR) / uptime_ms);
+
+  if (IS_ENABLED(CONFIG_APP_PERSIST_STATS)) {
+    LOG_INF("persist: %s, %" PRIu32 " writes, %" PRIu32 " bytes, %" PRIu32 " bytes/hour",
+      name, _persist.stats.writes, _persist.stats.bytes, _persist.stats.bytes_per_hour);
+  }
+}
+
+/**
+ * @brief Writes every entry that differs from flash. A failed write stays pending and is
+ *        retried at the next interval
+ *
+ * @param [in] work Unused, the flush work item
+ */
+static void _persist_flush(struct k_work *work __attribute__((unused))) {
+  persist_record record;
+  bool retry = false;
+
+  K_SPINLOCK(&_persist.lock) {
+    record = _persist.pending;
+  }
+
+  if (record.state != _persist.stored.state) {
+    uint8_t state = record.state;
+    if (0 == settings_save_one(PERSIST_TREE "/" PERSIST_KEY_STATE, &state, sizeof(state))) {
+      _persist.stored.state = record.state;
+      _persist_count(PERSIST_TREE "/" PERSIST_KEY_STATE, sizeof(state));
+    } else {
+      retry = true;
+    }
+  }
+
+  if (!_persist_same_msg(&record, &_persist.stored)) {
+    int rv = record.len
+      ? settings_save_one(PERSIST_TREE "/" PERSIST_KEY_MSG, record.chars, record.len)
+      : settings_delete(PERSIST_TREE "/" PERSIST_KEY_MSG);
+    if (0 == rv) {
+      _persist.stored.len = record.len;
+      memcpy(_persist.stored.chars, record.chars, record.len);
+      _persist_count(PERSIST_TREE "/" PERSIST_KEY_MSG, record.len);
+    } else {
+      retry = true;
+    }
+  }
+
+  if (retry) {
+    LOG_WRN("persist: write failed, retrying");
+    k_work_schedule(&_persist.flush, K_MSEC(CONFIG_APP_PERSIST_INTERVAL_MS));
+  }
+}
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Mounts the settings storage and restores the stored entries. Only the "app" tree
+ *        is loaded, two small entries, so the time taken is bounded by the storage backend's
+ *        lookup and is logged
+ *
+ * @return Error code, < 0 on failures
+ */
+int persist_init() {
+  k_work_init_delayable(&_persist.flush, _persist_flush);
+
+  uint32_t start = k_cycle_get_32();
+  int rv = settings_subsys_init();
+  if (0 == rv) {
+    rv = settings_load_subtree(PERSIST_TREE);
+  }
+  if (rv < 0) {
+    LOG_ERR("persist: settings failed (%d)", rv);
+    return rv;
+  }
+
+  // Nothing has changed yet
+  _persist.pending = _persist.stored;
+
+  LOG_INF("persist: restored state %d and %u characters in %" PRIu32 " us", _persist.stored.state,
+    _persist.stored.len, k_cyc_to_us_floor32(k_cycle_get_32() - start));
+  return 0;
+}
+
+/**
+ * @brief Gets the state restored at boot
+ *
+ * @return The state index, -ENOENT if none was stored
+ */
+int persist_last_state() {
+  return _persist.stored.state;
+}
+
+/**
+ * @brief Copies the message restored at boot
+ *
+ * @param [out] buf Filled with the restored characters
+ * @param [in] len Size of buf
+ *
+ * @return Number of characters copied into buf
+ */
+uint16_t persist_message(uint8_t *buf, uint16_t len) {
+  uint16_t count = MIN(len, _persist.stored.len);
+
+  memcpy(buf, _persist.stored.chars, count);
+  return count;
+}
+
+/**
+ * @brief Takes the current state and message, and arms a write if either changed. A write
+ *        that is already armed is left alone, so changes coalesce into it. Cheap enough to
+ *        call after every state machine run
+ *
+ * @param [in] state The state to restore into after a reset
+ */
+void persist_update(uint8_t state) {
+  persist_record next = {.state=state, .len=msg_entry_len()};
+
+  for (uint16_t i = 0; i < next.len; i++) {
+    next.chars[i] = msg_entry_peek(i);
+  }
+
+  // Only this thread writes pending, so it can be read without the lock
+  if (next.state == _persist.pending.state && _persist_same_msg(&next, &_persist.pending)) {
+    return;
+  }
+
+  K_SPINLOCK(&_persist.lock) {
+    _persist.pending = next;
+  }
+  k_work_schedule(&_persist.flush, K_MSEC(CONFIG_APP_PERSIST_INTERVAL_MS));
+}
+
+/**
+ * @brief Gets the flash write counters
+ *
+ * @param [out] stats Filled with the current counters
+ */
+void persist_get_stats(persist_stats *stats) {
+  *stats = _persist.stats;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file persist.h
+ *
+ * Keeps the entered message and the state it was entered in across resets, through the
+ * settings subsystem. Compiles to nothing unless CONFIG_APP_PERSIST is enabled.
+ */
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <stdint.h>
+#include <errno.h>
+
+/* ----------------------------------------------------------------------------
+                                    TYPES
+---------------------------------------------------------------------------- */
+typedef struct persist_stats_t {
+  uint32_t writes; // Settings entries written or deleted since boot
+  uint32_t bytes; // Names and values written since boot
+  uint32_t bytes_per_hour; // bytes scaled to the uptime at the last write
+} persist_stats;
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_APP_PERSIST
+
+int persist_init();
+
+int persist_last_state();
+
+uint16_t persist_message(uint8_t *buf, uint16_t len);
+
+void persist_update(uint8_t state);
+
+void persist_get_stats(persist_stats *stats);
+
+#else
+
+static inline int persist_init() { return 0; }
+
+static inline int persist_last_state() { return -ENOENT; }
+
+static inline uint16_t persist_message(uint8_t *buf, uint16_t len) { return 0; }
+
+static inline void persist_update(uint8_t state) {}
+
+static inline void persist_get_stats(persist_stats *stats) { *stats = (persist_stats){0}; }
+
+#endif // CONFIG_APP_PERSIST
+
+#endif // PERSIST_H
@@ -0,0 +1,113 @@
+/**
+ * @file sim_stimulus.c
+ *
+ * Types CONFIG_APP_SIM_STIMULUS_TEXT on the emulated buttons of native_sim, two characters
+ * per round, the same way a user would on the board: 8 bits on BTN0/BTN1, BTN3 to move on,
+ * 8 more bits, BTN3 twice to decode, then BTN2 to start over. Boards without emulated
+ * buttons, like nrf52_bsim, get the taps injected into the BTN driver instead.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#ifdef CONFIG_GPIO_EMUL
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#endif
+#include <zephyr/sys/printk.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "BTN.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define SIM_STIMULUS_STACK_SIZE   1024
+#define SIM_STIMULUS_PRIORITY     7
+#define SIM_STIMULUS_START_MS     100 // Let main finish its init first
+
+/* ----------------------------------------------------------------------------
+                                  Macro Helpers
+---------------------------------------------------------------------------- */
+#define SIM_BTN_SPEC(node_id)  GPIO_DT_SPEC_GET(node_id, gpios),
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static void _sim_tap(btn_id btn);
+
+static void _sim_type_char(char c);
+
+static void _sim_stimulus_loop(void *p1, void *p2, void *p3);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_GPIO_EMUL
+static const struct gpio_dt_spec _sim_btns[NUM_BTNS] = {
+  DT_FOREACH_CHILD_STATUS_OKAY(BTN_DT_PARENT, SIM_BTN_SPEC)
+};
+#endif
+
+K_THREAD_DEFINE(_sim_stimulus, SIM_STIMULUS_STACK_SIZE, _sim_stimulus_loop, NULL, NULL, NULL,
+  SIM_STIMULUS_PRIORITY, 0, SIM_STIMULUS_START_MS);
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Presses and releases an emulated button, or injects the press and the release
+ *
+ * @param [in] btn The button to tap
+ */
+static void _sim_tap(btn_id btn) {
+#ifdef CONFIG_GPIO_EMUL
+  gpio_emul_input_set(_sim_btns[btn].port, _sim_btns[btn].pin, 1);
+  k_msleep(CONFIG_APP_SIM_STIMULUS_TAP_MS);
+  gpio_emul_input_set(_sim_btns[btn].port, _sim_btns[btn].pin, 0);
+#else
+  BTN_inject(btn, BTN_EDGE_PRESS);
+  k_msleep(CONFIG_APP_SIM_STIMULUS_TAP_MS);
+  BTN_inject(btn, BTN_EDGE_RELEASE);
+#endif
+  k_msleep(CONFIG_APP_SIM_STIMULUS_TAP_MS);
+}
+
+/**
+ * @brief Enters one character MSB first, BTN0 for a 0 bit and BTN1 for a 1 bit
+ *
+ * @param [in] c The character to enter
+ */
+static void _sim_type_char(char c) {
+  for (int bit = 7; bit >= 0; bit--) {
+    _sim_tap((c & BIT(bit)) ? BTN1 : BTN0);
+  }
+}
+
+/**
+ * @brief Types the stimulus text forever, reporting the time each pair of characters took
+ *
+ * @param [in] p1 Unused thread parameter 1
+ * @param [in] p2 Unused thread parameter 2
+ * @param [in] p3 Unused thread parameter 3
+ */
+static void _sim_stimulus_loop(void *p1 __attribute__((unused)), void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
+  const char *text = CONFIG_APP_SIM_STIMULUS_TEXT;
+  size_t len = strlen(text);
+
+  if (0 == len) {
+    return;
+  }
+
+  for (size_t i = 0; ; i = (i + 2) % len) {
+    int64_t start = k_uptime_get();
+
+    _sim_type_char(text[i]);
+    _sim_tap(BTN3);
+    _sim_type_char(text[(i + 1) % len]);
+    _sim_tap(BTN3);
+    _sim_tap(BTN3);
+    _sim_tap(BTN2);
+
+    printk("stimulus: 20 taps in %" PRId64 " ms\n", k_uptime_get() - start);
+  }
+}
@@ -0,0 +1,73 @@
+/**
+ * @file sm_table.h
+ *
+ * Declarative transition tables for the SMF state machines. Transitions are listed
+ * once as X-macro rows of (state, event, guard, next, action):
+ *
+ *   #define TRANSITIONS(X) \
+ *     X(IDLE, EV_BTN0, NULL, RUNNING, start_motor) \
+ *     X(RUNNING, EV_BTN3, is_safe, IDLE, NULL)
+ *
+ *   static const sm_row transitions[NUM_STATES][NUM_EVENTS] = { TRANSITIONS(SM_ROW) };
+ *
+ * and expand into a dense [state][event] array, so finding the transition for an event
+ * is one index instead of a chain of comparisons. A (state, event) pair can only have
+ * one row, a second one overrides the first (and -Woverride-init warns about it).
+ */
+
+#ifndef SM_TABLE_H
+#define SM_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+                                  Pseudo States
+---------------------------------------------------------------------------- */
+#define SM_STAY       0xFF // Internal transition, only the action runs
+#define SM_HISTORY    0xFE // Return to the state the machine remembers as its last one
+
+/* ----------------------------------------------------------------------------
+                                    TYPES
+---------------------------------------------------------------------------- */
+typedef bool (*sm_guard)(void);
+
+typedef void (*sm_action)(void);
+
+typedef struct sm_row_t {
+  sm_guard guard; // NULL to always take the transition
+  sm_action action; // NULL for none, runs before the state changes
+  uint8_t next; // State index, SM_STAY or SM_HISTORY
+  bool used; // Cells without a row are all zero
+} sm_row;
+
+/* ----------------------------------------------------------------------------
+                                  Macro Helpers
+---------------------------------------------------------------------------- */
+#define SM_ROW(_state, _event, _guard, _next, _action) \
+  [_state][_event] = {.guard=_guard, .action=_action, .next=_next, .used=true},
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Looks up the transition a state takes for an event
+ *
+ * @param [in] table The dense table, &transitions[0][0]
+ * @param [in] num_events Number of events per state (second dimension of the table)
+ * @param [in] state The state the event arrived in
+ * @param [in] event The event that arrived
+ *
+ * @return The row to take, NULL if the state has none for the event or its guard failed
+ */
+static inline const sm_row *sm_table_find(const sm_row *table, uint8_t num_events, uint8_t state, uint8_t event) {
+  const sm_row *row = &table[state * num_events + event];
+
+  if (!row->used || (row->guard && !row->guard())) {
+    return NULL;
+  }
+  return row;
+}
+
+#endif // SM_TABLE_H
@@ -0,0 +1,199 @@
+/**
+ * @file sm_trace.c
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/printk.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "sm_trace.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define SM_TRACE_MAX_STATES     8
+#define SM_TRACE_BUCKETS        33 // Bucket n holds run times of [2^(n-1), 2^n) cycles, bucket 0 holds 0
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+typedef struct sm_trace_log_t {
+  sm_transition transitions[CONFIG_APP_SM_TRACE_DEPTH];
+  uint32_t next; // Total transitions recorded, the ring wraps at CONFIG_APP_SM_TRACE_DEPTH
+  uint32_t hist[SM_TRACE_MAX_STATES][SM_TRACE_BUCKETS];
+  uint32_t max_cycles[SM_TRACE_MAX_STATES];
+  uint32_t runs[SM_TRACE_MAX_STATES];
+  uint64_t total_cycles[SM_TRACE_MAX_STATES];
+  const char *const *names;
+  uint8_t name_count;
+} sm_trace_log;
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static const char *_sm_trace_name(uint8_t state);
+
+static void _sm_trace_report_work(struct k_work *work);
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+static sm_trace_log _sm_trace = {.next=0, .name_count=0};
+
+K_WORK_DELAYABLE_DEFINE(_sm_trace_report, _sm_trace_report_work);
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Looks up the printable name of a state
+ *
+ * @param [in] state The state index
+ *
+ * @return The registered name, or "?" if none was registered
+ */
+static const char *_sm_trace_name(uint8_t state) {
+  return (state < _sm_trace.name_count) ? _sm_trace.names[state] : "?";
+}
+
+/**
+ * @brief Prints the run cost report once CONFIG_APP_SM_TRACE_REPORT_MS has passed
+ *
+ * @param [in] work Unused, the report's work item
+ */
+static void _sm_trace_report_work(struct k_work *work __attribute__((unused))) {
+  sm_trace_report();
+}
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Registers printable state names, indexed by state
+ *
+ * @param [in] names Array of names, must stay valid
+ * @param [in] count Number of names
+ */
+void sm_trace_set_names(const char *const *names, uint8_t count) {
+  _sm_trace.names = names;
+  _sm_trace.name_count = count;
+  if (CONFIG_APP_SM_TRACE_REPORT_MS) {
+    k_work_schedule(&_sm_trace_report, K_MSEC(CONFIG_APP_SM_TRACE_REPORT_MS));
+  }
+}
+
+/**
+ * @brief Records a transition in the trace ring, overwriting the oldest once full
+ *
+ * @param [in] from The state being left
+ * @param [in] to The state being entered
+ */
+void sm_trace_transition(uint8_t from, uint8_t to) {
+  sm_transition *entry = &_sm_trace.transitions[_sm_trace.next % CONFIG_APP_SM_TRACE_DEPTH];
+
+  entry->from = from;
+  entry->to = to;
+  entry->timestamp = k_cycle_get_32();
+  _sm_trace.next++;
+}
+
+/**
+ * @brief Marks the start of a state run
+ *
+ * @return Start time to pass to sm_trace_run_end
+ */
+uint32_t sm_trace_run_begin() {
+  return k_cycle_get_32();
+}
+
+/**
+ * @brief Adds the time since sm_trace_run_begin to the state's log2 histogram
+ *
+ * @param [in] state The state that ran
+ * @param [in] start The value returned by sm_trace_run_begin
+ */
+void sm_trace_run_end(uint8_t state, uint32_t start) {
+  uint32_t cycles = k_cycle_get_32() - start;
+
+  if (state >= SM_TRACE_MAX_STATES) {
+    return;
+  }
+
+  _sm_trace.hist[state][cycles ? 32 - __builtin_clz(cycles) : 0]++;
+  _sm_trace.max_cycles[state] = MAX(_sm_trace.max_cycles[state], cycles);
+  _sm_trace.runs[state]++;
+  _sm_trace.total_cycles[state] += cycles;
+}
+
+/**
+ * @brief Prints the number of runs and the average and worst run time of every state that ran,
+ *        the time of one dispatch through the transition table and the state's run action
+ */
+void sm_trace_report() {
+  for (uint8_t state = 0; state < SM_TRACE_MAX_STATES; state++) {
+    uint32_t runs = _sm_trace.runs[state];
+
+    if (!runs) {
+      continue;
+    }
+    printk("sm trace: %s %" PRIu32 " runs, avg %" PRIu32 " cycles, max %" PRIu32 " cycles (%" PRIu32 " us)\n",
+      _sm_trace_name(state), runs, (uint32_t)(_sm_trace.total_cycles[state] / runs),
+      _sm_trace.max_cycles[state], k_cyc_to_us_ceil32(_sm_trace.max_cycles[state]));
+  }
+  printk("sm trace: report done, %" PRIu32 " cycles per second\n", (uint32_t)sys_clock_hw_cycles_per_sec());
+}
+
+/* ----------------------------------------------------------------------------
+                                Shell Commands
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_SHELL
+
+static int _sm_cmd_trace(const struct shell *sh, size_t argc, char **argv) {
+  uint32_t count = MIN(_sm_trace.next, CONFIG_APP_SM_TRACE_DEPTH);
+
+  for (uint32_t i = _sm_trace.next - count; i < _sm_trace.next; i++) {
+    const sm_transition *entry = &_sm_trace.transitions[i % CONFIG_APP_SM_TRACE_DEPTH];
+    shell_print(sh, "%10" PRIu32 " us  %s -> %s", k_cyc_to_us_floor32(entry->timestamp),
+      _sm_trace_name(entry->from), _sm_trace_name(entry->to));
+  }
+  shell_print(sh, "%" PRIu32 " transitions total", _sm_trace.next);
+  return 0;
+}
+
+static int _sm_cmd_hist(const struct shell *sh, size_t argc, char **argv) {
+  for (uint8_t state = 0; state < SM_TRACE_MAX_STATES; state++) {
+    if (!_sm_trace.max_cycles[state] && !_sm_trace.hist[state][0]) {
+      continue;
+    }
+
+    shell_print(sh, "%s: max %" PRIu32 " cycles (%" PRIu32 " us)", _sm_trace_name(state),
+      _sm_trace.max_cycles[state], k_cyc_to_us_floor32(_sm_trace.max_cycles[state]));
+    for (uint8_t bucket = 0; bucket < SM_TRACE_BUCKETS; bucket++) {
+      if (_sm_trace.hist[state][bucket]) {
+        shell_print(sh, "  < 2^%-2u cycles: %" PRIu32, bucket, _sm_trace.hist[state][bucket]);
+      }
+    }
+  }
+  return 0;
+}
+
+static int _sm_cmd_reset(const struct shell *sh, size_t argc, char **argv) {
+  _sm_trace.next = 0;
+  memset(_sm_trace.hist, 0, sizeof(_sm_trace.hist));
+  memset(_sm_trace.max_cycles, 0, sizeof(_sm_trace.max_cycles));
+  memset(_sm_trace.runs, 0, sizeof(_sm_trace.runs));
+  memset(_sm_trace.total_cycles, 0, sizeof(_sm_trace.total_cycles));
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(_sm_cmds,
+  SHELL_CMD(trace, NULL, "Show the most recent state transitions", _sm_cmd_trace),
+  SHELL_CMD(hist, NULL, "Show log2 histograms of run time per state", _sm_cmd_hist),
+  SHELL_CMD(reset, NULL, "Clear the transition trace and histograms", _sm_cmd_reset),
+  SHELL_SUBCMD_SET_END
+);
+SHELL_CMD_REGISTER(sm, &_sm_cmds, "State machine tracing", NULL);
+
+#endif // CONFIG_SHELL
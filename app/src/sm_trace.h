@@ -0,0 +1,51 @@
+/**
+ * @file sm_trace.h
+ *
+ * State machine transition tracing and per-state run time histograms.
+ * Compiles to nothing unless CONFIG_APP_SM_TRACE is enabled.
+ */
+
+#ifndef SM_TRACE_H
+#define SM_TRACE_H
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+                                    TYPES
+---------------------------------------------------------------------------- */
+typedef struct sm_transition_t {
+  uint8_t from;
+  uint8_t to;
+  uint32_t timestamp; // k_cycle_get_32() when the transition was requested
+} sm_transition;
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_APP_SM_TRACE
+
+void sm_trace_set_names(const char *const *names, uint8_t count);
+
+void sm_trace_transition(uint8_t from, uint8_t to);
+
+uint32_t sm_trace_run_begin();
+
+void sm_trace_run_end(uint8_t state, uint32_t start);
+
+void sm_trace_report();
+
+#else
+
+static inline void sm_trace_set_names(const char *const *names, uint8_t count) {}
+
+static inline void sm_trace_transition(uint8_t from, uint8_t to) {}
+
+static inline uint32_t sm_trace_run_begin() { return 0; }
+
+static inline void sm_trace_run_end(uint8_t state, uint32_t start) {}
+
+static inline void sm_trace_report() {}
+
+#endif // CONFIG_APP_SM_TRACE
+
+#endif // SM_TRACE_H
@@ -0,0 +1,484 @@
+/**
+ * @file uart_input.c
+ *
+ * Reads tap frames from the chosen app,input-uart and injects every tap into the BTN driver
+ * back to back, as long as the BTN queues have room for both of its edges. The state machine
+ * takes every queued press in order, so taps are never merged or lost however fast they
+ * arrive. Decoded messages are sent back as frames on the same UART.
+ *
+ * The UART interrupt moves received bytes into a ring buffer and wakes the input thread,
+ * which only sleeps on the state machine's signal while the BTN queues are full. Replies go the other way:
+ * the state machine only copies them into a second ring buffer and the interrupt sends them,
+ * so END never waits on the UART. Nothing polls, so the thread costs no CPU while the UART
+ * is quiet or the state machine is busy.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <string.h>
+
+#include "BTN.h"
+#include "uart_input.h"
+
+/* ----------------------------------------------------------------------------
+                                    Constants
+---------------------------------------------------------------------------- */
+#define UART_INPUT_STACK_SIZE   1024
+#define UART_INPUT_PRIORITY     7 // Below main, so the state machine runs as soon as a tap lands
+#define UART_INPUT_RX_SIZE      CONFIG_APP_UART_INPUT_RX_SIZE
+#define UART_INPUT_TX_SIZE      CONFIG_APP_UART_INPUT_TX_SIZE
+#define UART_INPUT_CHUNK        16 // Bytes moved per ring buffer access
+
+#define UART_INPUT_LOOPBACK_TEXT    "Hi"
+#define UART_INPUT_LOOPBACK_FRAMES  CONFIG_APP_UART_INPUT_LOOPBACK_FRAMES
+#define UART_INPUT_LOOPBACK_START_MS  200 // Let main finish its init and enter ENTRYA first
+#define UART_INPUT_LOOPBACK_REPLY_MS  1000 // A frame of 20 taps is answered well within this
+
+#define UART_INPUT_SOF          0x7E
+#define UART_INPUT_TAP_BITS     2
+#define UART_INPUT_TAPS_PER_BYTE  (8 / UART_INPUT_TAP_BITS)
+#define UART_INPUT_MAX_PAYLOAD  DIV_ROUND_UP(UINT8_MAX, UART_INPUT_TAPS_PER_BYTE)
+
+BUILD_ASSERT(NUM_BTNS > BTN3, "taps address BTN0 - BTN3");
+
+LOG_MODULE_DECLARE(app, CONFIG_APP_LOG_LEVEL);
+
+/* ----------------------------------------------------------------------------
+                                    Types
+---------------------------------------------------------------------------- */
+typedef enum uart_input_state_t {
+  UART_INPUT_WAIT_SOF = 0,
+  UART_INPUT_LEN,
+  UART_INPUT_PAYLOAD,
+  UART_INPUT_CHECKSUM,
+} uart_input_state;
+
+/*
+ * Only touched by the input thread
+ */
+typedef struct uart_input_frame_t {
+  uint8_t state; // One of uart_input_state
+  uint8_t taps;
+  uint8_t len; // Payload bytes received so far
+  uint8_t checksum; // Running xor of len and the payload
+  uint8_t payload[UART_INPUT_MAX_PAYLOAD];
+} uart_input_frame;
+
+/*
+ * Filled by the UART interrupt, and the loopback thread, drained by the input thread
+ */
+typedef struct uart_input_rx_t {
+  struct k_spinlock lock;
+  struct ring_buf ring;
+  uint8_t buf[UART_INPUT_RX_SIZE];
+  uint32_t overruns; // Bytes lost because the ring buffer was full
+} uart_input_rx;
+
+/*
+ * Filled by uart_input_reply on the main thread, drained by the UART interrupt
+ */
+typedef struct uart_input_tx_t {
+  struct k_spinlock lock;
+  struct ring_buf ring;
+  uint8_t buf[UART_INPUT_TX_SIZE];
+  bool ready; // The ring is set up and the interrupt installed, replies before that are dropped
+  uint32_t dropped; // Replies that didn't fit and were never sent
+} uart_input_tx;
+
+#ifdef CONFIG_APP_UART_INPUT_LOOPBACK
+/*
+ * Replies are checked by uart_input_reply, on the main thread
+ */
+typedef struct uart_input_loopback_t {
+  atomic_t replies;
+  atomic_t matched; // Replies that were UART_INPUT_LOOPBACK_TEXT
+} uart_input_loopback;
+#endif
+
+/* ----------------------------------------------------------------------------
+                            Private Function Prototypes
+---------------------------------------------------------------------------- */
+static void _uart_input_received(const uint8_t *bytes, uint32_t len);
+
+static void _uart_input_transmit(const struct device *dev);
+
+static void _uart_input_isr(const struct device *dev, void *user_data);
+
+static void _uart_input_wait_room();
+
+static void _uart_input_tap(btn_id btn);
+
+static void _uart_input_frame_done(const uart_input_frame *frame);
+
+static void _uart_input_byte(uart_input_frame *frame, uint8_t byte);
+
+static void _uart_input_loop(void *p1, void *p2, void *p3);
+
+#ifdef CONFIG_APP_UART_INPUT_LOOPBACK
+static void _uart_input_loopback_tap(uint8_t *payload, uint8_t *taps, btn_id btn);
+
+static uint8_t _uart_input_loopback_frame(uint8_t *frame, const char *text);
+
+static void _uart_input_loopback_loop(void *p1, void *p2, void *p3);
+#endif
+
+/* ----------------------------------------------------------------------------
+                                Global States
+---------------------------------------------------------------------------- */
+static const struct device *const _uart_input_dev = DEVICE_DT_GET(DT_CHOSEN(app_input_uart));
+
+static uart_input_rx _uart_input_rx;
+
+static uart_input_tx _uart_input_tx = {.ready=false, .dropped=0};
+
+K_SEM_DEFINE(_uart_input_rx_ready, 0, 1); // Given by the interrupt when bytes are in the ring
+
+K_SEM_DEFINE(_uart_input_taken, 0, 1); // Given by the state machine after taking events
+
+K_THREAD_DEFINE(_uart_input, UART_INPUT_STACK_SIZE, _uart_input_loop, NULL, NULL, NULL,
+  UART_INPUT_PRIORITY, 0, 0);
+
+#ifdef CONFIG_APP_UART_INPUT_LOOPBACK
+static uart_input_loopback _uart_input_loopback = {.replies=ATOMIC_INIT(0), .matched=ATOMIC_INIT(0)};
+
+K_SEM_DEFINE(_uart_input_replied, 0, K_SEM_MAX_LIMIT); // One count per reply
+
+K_THREAD_DEFINE(_uart_input_loopback_thread, UART_INPUT_STACK_SIZE, _uart_input_loopback_loop,
+  NULL, NULL, NULL, UART_INPUT_PRIORITY, 0, UART_INPUT_LOOPBACK_START_MS);
+#endif
+
+/* ----------------------------------------------------------------------------
+                              Private Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Queues received bytes for the input thread and wakes it. Safe from the UART interrupt
+ *
+ * @param [in] bytes The received bytes
+ * @param [in] len Number of bytes
+ */
+static void _uart_input_received(const uint8_t *bytes, uint32_t len) {
+  K_SPINLOCK(&_uart_input_rx.lock) {
+    _uart_input_rx.overruns += len - ring_buf_put(&_uart_input_rx.ring, bytes, len);
+  }
+  k_sem_give(&_uart_input_rx_ready);
+}
+
+/**
+ * @brief Moves queued reply bytes into the UART's transmit FIFO, stops the transmit interrupt
+ *        once every reply is out. Runs from the UART interrupt
+ *
+ * @param [in] dev The input UART
+ */
+static void _uart_input_transmit(const struct device *dev) {
+  K_SPINLOCK(&_uart_input_tx.lock) {
+    uint8_t *data;
+    uint32_t len = ring_buf_get_claim(&_uart_input_tx.ring, &data, UART_INPUT_CHUNK);
+    int sent = len ? uart_fifo_fill(dev, data, len) : 0;
+
+    ring_buf_get_finish(&_uart_input_tx.ring, MAX(sent, 0));
+    if (ring_buf_is_empty(&_uart_input_tx.ring)) {
+      uart_irq_tx_disable(dev);
+    }
+  }
+}
+
+/**
+ * @brief Empties the UART's receive FIFO into the ring buffer and refills its transmit FIFO
+ *
+ * @param [in] dev The input UART
+ * @param [in] user_data Unused
+ */
+static void _uart_input_isr(const struct device *dev, void *user_data __attribute__((unused))) {
+  uint8_t chunk[UART_INPUT_CHUNK];
+
+  while (uart_irq_update(dev) && uart_irq_rx_ready(dev)) {
+    int len = uart_fifo_read(dev, chunk, sizeof(chunk));
+    if (len <= 0) {
+      break;
+    }
+    _uart_input_received(chunk, len);
+  }
+
+  if (uart_irq_tx_ready(dev)) {
+    _uart_input_transmit(dev);
+  }
+}
+
+/**
+ * @brief Waits until the BTN queues have room for both edges of a tap. Sleeps between checks,
+ *        every run of the state machine wakes it
+ */
+static void _uart_input_wait_room() {
+  btn_event_stats stats;
+
+  BTN_get_event_stats(&stats);
+  while (stats.queued + 2 > BTN_EVENT_QUEUE_SIZE) {
+    k_sem_take(&_uart_input_taken, K_FOREVER);
+    BTN_get_event_stats(&stats);
+  }
+}
+
+/**
+ * @brief Presses and releases a button through the BTN driver, once both edges fit the queues
+ *
+ * @param [in] btn The button to tap
+ */
+static void _uart_input_tap(btn_id btn) {
+  _uart_input_wait_room();
+  BTN_inject(btn, BTN_EDGE_PRESS);
+  BTN_inject(btn, BTN_EDGE_RELEASE);
+}
+
+/**
+ * @brief Taps every button of a frame that passed its checksum, in order
+ *
+ * @param [in] frame The received frame
+ */
+static void _uart_input_frame_done(const uart_input_frame *frame) {
+  for (uint16_t i = 0; i < frame->taps; i++) {
+    uint8_t byte = frame->payload[i / UART_INPUT_TAPS_PER_BYTE];
+    uint8_t shift = (i % UART_INPUT_TAPS_PER_BYTE) * UART_INPUT_TAP_BITS;
+
+    _uart_input_tap((byte >> shift) & BIT_MASK(UART_INPUT_TAP_BITS));
+  }
+}
+
+/**
+ * @brief Runs one received byte through the frame parser. A bad checksum drops the frame and
+ *        the parser looks for the next start of frame
+ *
+ * @param [in,out] frame The frame being received
+ * @param [in] byte The received byte
+ */
+static void _uart_input_byte(uart_input_frame *frame, uint8_t byte) {
+  switch (frame->state) {
+    case UART_INPUT_WAIT_SOF:
+      if (UART_INPUT_SOF == byte) {
+        frame->state = UART_INPUT_LEN;
+      }
+      break;
+    case UART_INPUT_LEN:
+      frame->taps = byte;
+      frame->len = 0;
+      frame->checksum = byte;
+      frame->state = byte ? UART_INPUT_PAYLOAD : UART_INPUT_WAIT_SOF;
+      break;
+    case UART_INPUT_PAYLOAD:
+      frame->payload[frame->len++] = byte;
+      frame->checksum ^= byte;
+      if (frame->len == DIV_ROUND_UP(frame->taps, UART_INPUT_TAPS_PER_BYTE)) {
+        frame->state = UART_INPUT_CHECKSUM;
+      }
+      break;
+    case UART_INPUT_CHECKSUM:
+      if (byte == frame->checksum) {
+        _uart_input_frame_done(frame);
+      } else {
+        LOG_WRN("uart input: bad checksum, %u taps dropped", frame->taps);
+      }
+      frame->state = UART_INPUT_WAIT_SOF;
+      break;
+    default:
+      frame->state = UART_INPUT_WAIT_SOF;
+      break;
+  }
+}
+
+/**
+ * @brief Parses received bytes forever, sleeping until the interrupt has queued more
+ *
+ * @param [in] p1 Unused thread parameter 1
+ * @param [in] p2 Unused thread parameter 2
+ * @param [in] p3 Unused thread parameter 3
+ */
+static void _uart_input_loop(void *p1 __attribute__((unused)), void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
+  uart_input_frame frame = {.state=UART_INPUT_WAIT_SOF};
+  uint8_t chunk[UART_INPUT_CHUNK];
+  uint32_t reported = 0;
+
+  ring_buf_init(&_uart_input_rx.ring, sizeof(_uart_input_rx.buf), _uart_input_rx.buf);
+
+  if (!device_is_ready(_uart_input_dev)) {
+    LOG_ERR("uart input: %s not ready", _uart_input_dev->name);
+    return;
+  }
+
+  int rv = uart_irq_callback_user_data_set(_uart_input_dev, _uart_input_isr, NULL);
+  if (rv < 0) {
+    LOG_ERR("uart input: no interrupt driven API on %s (%d)", _uart_input_dev->name, rv);
+    return;
+  }
+  K_SPINLOCK(&_uart_input_tx.lock) {
+    ring_buf_init(&_uart_input_tx.ring, sizeof(_uart_input_tx.buf), _uart_input_tx.buf);
+    _uart_input_tx.ready = true;
+  }
+  uart_irq_rx_enable(_uart_input_dev);
+
+  while (1) {
+    uint32_t len;
+    uint32_t overruns;
+
+    k_sem_take(&_uart_input_rx_ready, K_FOREVER);
+    do {
+      K_SPINLOCK(&_uart_input_rx.lock) {
+        len = ring_buf_get(&_uart_input_rx.ring, chunk, sizeof(chunk));
+        overruns = _uart_input_rx.overruns;
+      }
+      for (uint32_t i = 0; i < len; i++) {
+        _uart_input_byte(&frame, chunk[i]);
+      }
+    } while (len);
+
+    if (overruns != reported) {
+      LOG_WRN("uart input: %u bytes lost to a full buffer", overruns - reported);
+      reported = overruns;
+    }
+  }
+}
+
+#ifdef CONFIG_APP_UART_INPUT_LOOPBACK
+/**
+ * @brief Packs one more tap into a frame's payload
+ *
+ * @param [in,out] payload The payload, zeroed before the first tap
+ * @param [in,out] taps Taps packed so far
+ * @param [in] btn The button to tap
+ */
+static void _uart_input_loopback_tap(uint8_t *payload, uint8_t *taps, btn_id btn) {
+  payload[*taps / UART_INPUT_TAPS_PER_BYTE] |= btn << ((*taps % UART_INPUT_TAPS_PER_BYTE) * UART_INPUT_TAP_BITS);
+  (*taps)++;
+}
+
+/**
+ * @brief Builds the frame a host would send to enter a message: the bits of the first
+ *        character, BTN3, the bits of the rest, BTN3 twice to decode and BTN2 to start over
+ *
+ * @param [out] frame Filled with the frame, room for UART_INPUT_MAX_PAYLOAD + 3 bytes
+ * @param [in] text The message, up to 27 characters so the taps fit one frame
+ *
+ * @return Length of the frame in bytes
+ */
+static uint8_t _uart_input_loopback_frame(uint8_t *frame, const char *text) {
+  uint8_t *payload = &frame[2];
+  uint8_t taps = 0;
+
+  memset(payload, 0, UART_INPUT_MAX_PAYLOAD);
+  for (size_t c = 0; text[c]; c++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      _uart_input_loopback_tap(payload, &taps, (text[c] & BIT(bit)) ? BTN1 : BTN0);
+    }
+    if (0 == c) {
+      _uart_input_loopback_tap(payload, &taps, BTN3);
+    }
+  }
+  _uart_input_loopback_tap(payload, &taps, BTN3);
+  _uart_input_loopback_tap(payload, &taps, BTN3);
+  _uart_input_loopback_tap(payload, &taps, BTN2);
+
+  uint8_t len = DIV_ROUND_UP(taps, UART_INPUT_TAPS_PER_BYTE);
+  uint8_t checksum = taps;
+  for (uint8_t i = 0; i < len; i++) {
+    checksum ^= payload[i];
+  }
+  frame[0] = UART_INPUT_SOF;
+  frame[1] = taps;
+  frame[2 + len] = checksum;
+  return len + 3;
+}
+
+/**
+ * @brief Feeds UART_INPUT_LOOPBACK_FRAMES message frames through the receive path back to
+ *        back, keeping no more in flight than the receive buffer holds, and prints how many
+ *        decoded replies came back and how fast
+ *
+ * @param [in] p1 Unused thread parameter 1
+ * @param [in] p2 Unused thread parameter 2
+ * @param [in] p3 Unused thread parameter 3
+ */
+static void _uart_input_loopback_loop(void *p1 __attribute__((unused)), void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
+  uint8_t frame[UART_INPUT_MAX_PAYLOAD + 3];
+  uint8_t len = _uart_input_loopback_frame(frame, UART_INPUT_LOOPBACK_TEXT);
+  uint32_t taps = frame[1];
+  int window = MAX(UART_INPUT_RX_SIZE / len, 1); // Frames in flight that can't overrun the ring
+  int sent = 0;
+  int replied = 0;
+  int64_t start = k_uptime_get();
+
+  for (; sent < UART_INPUT_LOOPBACK_FRAMES; sent++) {
+    if (sent - replied >= window) {
+      if (0 != k_sem_take(&_uart_input_replied, K_MSEC(UART_INPUT_LOOPBACK_REPLY_MS))) {
+        break;
+      }
+      replied++;
+    }
+    _uart_input_received(frame, len);
+  }
+  while (replied < sent && 0 == k_sem_take(&_uart_input_replied, K_MSEC(UART_INPUT_LOOPBACK_REPLY_MS))) {
+    replied++;
+  }
+
+  int64_t elapsed = k_uptime_get() - start;
+  printk("uart input: %d frames looped back, %ld replies, %ld matched\n", UART_INPUT_LOOPBACK_FRAMES,
+    (long)atomic_get(&_uart_input_loopback.replies), (long)atomic_get(&_uart_input_loopback.matched));
+  printk("uart input: %u taps in %lld ms\n", taps * UART_INPUT_LOOPBACK_FRAMES, (long long)elapsed);
+}
+#endif // CONFIG_APP_UART_INPUT_LOOPBACK
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+/**
+ * @brief Tells the input thread the state machine has taken the queued button events, so it
+ *        can check whether there is room for the next tap. Called on every state machine run
+ */
+void uart_input_taken() {
+  k_sem_give(&_uart_input_taken);
+}
+
+/**
+ * @brief Queues a decoded message as one frame for the UART interrupt to send back to the
+ *        host. Never waits on the UART, a frame that doesn't fit the transmit buffer whole is
+ *        dropped and logged
+ *
+ * @param [in] chars The decoded characters
+ * @param [in] len Number of characters, only the first 255 are sent
+ */
+void uart_input_reply(const char *chars, uint16_t len) {
+  uint8_t count = MIN(len, UINT8_MAX);
+  uint8_t header[2] = {UART_INPUT_SOF, count};
+  uint8_t checksum = count;
+  bool queued = false;
+
+  for (uint8_t i = 0; i < count; i++) {
+    checksum ^= chars[i];
+  }
+
+  K_SPINLOCK(&_uart_input_tx.lock) {
+    if (!_uart_input_tx.ready || ring_buf_space_get(&_uart_input_tx.ring) < count + 3) {
+      _uart_input_tx.dropped++;
+      K_SPINLOCK_BREAK;
+    }
+    ring_buf_put(&_uart_input_tx.ring, header, sizeof(header));
+    ring_buf_put(&_uart_input_tx.ring, (const uint8_t *)chars, count);
+    ring_buf_put(&_uart_input_tx.ring, &checksum, 1);
+    queued = true;
+  }
+
+  if (queued) {
+    uart_irq_tx_enable(_uart_input_dev);
+  } else {
+    LOG_WRN("uart input: reply of %u characters dropped, the transmit buffer is full", count);
+  }
+
+#ifdef CONFIG_APP_UART_INPUT_LOOPBACK
+  atomic_inc(&_uart_input_loopback.replies);
+  if (sizeof(UART_INPUT_LOOPBACK_TEXT) - 1 == len && 0 == memcmp(chars, UART_INPUT_LOOPBACK_TEXT, len)) {
+    atomic_inc(&_uart_input_loopback.matched);
+  }
+  k_sem_give(&_uart_input_replied);
+#endif
+}
@@ -0,0 +1,37 @@
+/**
+ * @file uart_input.h
+ *
+ * Virtual buttons over a UART, so the state machine can be driven at full speed from a host
+ * script. Compiles to nothing unless CONFIG_APP_UART_INPUT is enabled.
+ *
+ * Both directions use the same frame:
+ *   0x7E | len | payload[] | xor of len and every payload byte
+ * Towards the board len is a tap count, 1 - 255, and the payload packs one btn_id per tap in
+ * 2 bits, 4 taps per byte starting from the low bits. Every tap is a press and a release.
+ * Back from the board len is a character count and the payload is every character of a
+ * decoded message.
+ */
+
+#ifndef UART_INPUT_H
+#define UART_INPUT_H
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+                              Public Functions
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_APP_UART_INPUT
+
+void uart_input_taken();
+
+void uart_input_reply(const char *chars, uint16_t len);
+
+#else
+
+static inline void uart_input_taken() {}
+
+static inline void uart_input_reply(const char *chars, uint16_t len) {}
+
+#endif // CONFIG_APP_UART_INPUT
+
+#endif // UART_INPUT_H
@@ -6,29 +6,105 @@ Header to define button interface
 #define BTN_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+
+/* ----------------------------------------------------------------------------
+                                  Macro Helpers
+---------------------------------------------------------------------------- */
+#define BTN_DT_PARENT   DT_PARENT(DT_ALIAS(sw0)) // The gpio-keys node, every enabled child is a button
+#define NUM_BTNS        DT_CHILD_NUM_STATUS_OKAY(BTN_DT_PARENT)
+#define BTN_EVENT_QUEUE_SIZE  16 // Events, and injected edges, waiting to be taken. Must be a power of 2
 
 /* ----------------------------------------------------------------------------
                                     TYPES
 ---------------------------------------------------------------------------- */
+// Buttons are numbered in devicetree order, boards with more than four use plain indices past BTN3
 typedef enum btn_id_t {
   BTN0 = 0,
   BTN1,
   BTN2,
   BTN3,
-  NUM_BTNS,
 } btn_id;
 
+typedef enum btn_edge_t {
+  BTN_EDGE_RELEASE = 0,
+  BTN_EDGE_PRESS,
+} btn_edge;
+
+typedef struct btn_event_t {
+  uint8_t btn; // btn_id of the button that changed
+  uint8_t edge; // btn_edge the button changed to
+  uint32_t timestamp; // k_cycle_get_32() at the first edge of the bounce
+} btn_event;
+
+typedef struct btn_event_stats_t {
+  uint32_t reported; // Debounced presses and releases reported since boot
+  uint32_t queued; // Events, and injected edges, not taken yet
+  uint32_t overflow; // Events lost because the event queue was full
+  uint32_t dropped; // Edge pairs swallowed by the debouncer, e.g. taps shorter than the debounce time
+} btn_event_stats;
+
+typedef enum btn_gesture_type_t {
+  BTN_GESTURE_CHORD = 0, // Every button in mask held together (others allowed) for time_ms
+  BTN_GESTURE_LONG_PRESS, // Exactly the buttons in mask held, nothing else, for time_ms
+  BTN_GESTURE_DOUBLE_TAP, // The buttons in mask pressed twice, second press within time_ms of the first
+} btn_gesture_type;
+
+typedef struct btn_gesture_t {
+  uint8_t type; // One of btn_gesture_type
+  uint32_t mask; // BIT(BTNx) of every button in the gesture
+  uint16_t time_ms; // Hold time for chords and long presses, tap window for double taps
+} btn_gesture;
+
+typedef struct btn_trace_entry_t {
+  uint32_t time_us; // First edge of the bounce, relative to BTN_trace_start
+  uint8_t btn; // btn_id of the button that changed
+  uint8_t edge; // btn_edge the button changed to
+} btn_trace_entry;
+
+typedef void (*btn_callback)(btn_id btn);
+
+typedef void (*btn_gesture_callback)(uint8_t gesture);
+
 /* ----------------------------------------------------------------------------
                               Public Functions
 ---------------------------------------------------------------------------- */
 int BTN_init();
 
+bool BTN_get_init_cycles(uint32_t *start, uint32_t *end);
+
 bool BTN_is_pressed(btn_id btn);
 
+uint32_t BTN_get_mask();
+
+uint32_t BTN_get_raw_mask();
+
 bool BTN_check_clear_pressed(btn_id btn);
 
 bool BTN_check_pressed(btn_id btn);
 
 void BTN_clear_pressed(btn_id btn);
 
+void BTN_set_callback(btn_callback cb);
+
+int BTN_get_event(btn_event *evt);
+
+int BTN_wait_event(btn_event *evt, k_timeout_t timeout);
+
+void BTN_get_event_stats(btn_event_stats *stats);
+
+int BTN_inject(btn_id btn, btn_edge edge);
+
+int BTN_gesture_register(const btn_gesture *table, uint8_t count, btn_gesture_callback cb);
+
+void BTN_trace_start();
+
+void BTN_trace_stop();
+
+uint32_t BTN_trace_read(btn_trace_entry *buf, uint32_t len);
+
+void BTN_trace_dump();
+
 #endif
\ No newline at end of file
@@ -1,129 +1,624 @@
 /*
 Header to define button module logic
+
+Edges are debounced with the strategy picked in Kconfig:
+- delayed: report once the contact has been quiet for CONFIG_BTN_DEBOUNCE_MS, every bounce
+  pushes the report out again
+- lockout: report the leading edge straight away, then ignore the contact for
+  CONFIG_BTN_DEBOUNCE_MS and report whatever it settled on once the window ends
+- integrator: sample every CONFIG_BTN_DEBOUNCE_SAMPLE_MS and count up while pressed, down
+  while released, report when the count saturates. A bounce only costs the samples it
+  spans instead of restarting the wait
+Every strategy reports presses and releases, and is only run from the system workqueue.
 */
 
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
+#include <zephyr/init.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/sys/printk.h>
+#include <zephyr/shell/shell.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "BTN.h"
 
 /* ----------------------------------------------------------------------------
                                     Constants
 ---------------------------------------------------------------------------- */
-#define BTN_DEBOUNCE_MS   20
+#define BTN_DEBOUNCE_MS       CONFIG_BTN_DEBOUNCE_MS
+#define BTN_GESTURE_MAX       8 // Most gestures a table can hold
 
 /* ----------------------------------------------------------------------------
                                   Macro Helpers
 ---------------------------------------------------------------------------- */
-#define BTN0_NODE             DT_ALIAS(sw0)
-#define BTN1_NODE             DT_ALIAS(sw1)
-#define BTN2_NODE             DT_ALIAS(sw2)
-#define BTN3_NODE             DT_ALIAS(sw3)
+#define BTN_SPEC(node_id)     GPIO_DT_SPEC_GET(node_id, gpios),
 
 #define IS_INVALID_BTN(btn)   (btn >= NUM_BTNS || btn < 0)
+#define BTN_NO_PIN            0xFF // Port pins that aren't a button
+
+BUILD_ASSERT(NUM_BTNS > 0 && NUM_BTNS <= 32, "button masks are 32 bits wide");
+
+#ifdef CONFIG_BTN_DEBOUNCE_INTEGRATOR
+#define BTN_INTEGRATOR_MAX    (BTN_DEBOUNCE_MS / CONFIG_BTN_DEBOUNCE_SAMPLE_MS) // Count of a settled press
+BUILD_ASSERT(BTN_INTEGRATOR_MAX >= 1 && BTN_INTEGRATOR_MAX <= UINT8_MAX,
+  "BTN_DEBOUNCE_MS must be 1 - 255 samples");
+#endif
+
+#define BTN_EVENT_QUEUE_MASK  (BTN_EVENT_QUEUE_SIZE - 1)
+BUILD_ASSERT(IS_POWER_OF_TWO(BTN_EVENT_QUEUE_SIZE), "BTN_EVENT_QUEUE_SIZE must be a power of 2");
 
 /* ----------------------------------------------------------------------------
                                     Types
 ---------------------------------------------------------------------------- */
+/*
+ * Runtime state of a button, its pin lives in the matching entry of _btn_specs
+ */
 typedef struct btn_gpio_t {
-  struct gpio_dt_spec spec; 
+  btn_id id;
   volatile bool pressed;
-  struct gpio_callback cb;
+  bool level; // Last debounced level, true when pressed
+  uint32_t edge_timestamp; // Cycle count of the first edge since the button was last stable
+  atomic_t locked; // Lockout: the leading edge was taken, the contact is ignored until this clears
+  uint8_t integrator; // Integrator: 0 when settled released, BTN_INTEGRATOR_MAX when settled pressed
+  bool reported; // Integrator: an edge was reported since the count last settled
   struct k_work_delayable work;
 } btn_gpio;
 
+/*
+ * One per GPIO port with buttons on it. A single callback covers every button on the port
+ * and finds the button behind each pin with one lookup
+ */
+typedef struct btn_port_t {
+  const struct device *dev;
+  gpio_port_pins_t pins; // BIT(pin) of every button on the port
+  uint8_t btn[GPIO_MAX_PINS_PER_PORT]; // btn_id on each pin, BTN_NO_PIN for the others
+  struct gpio_callback cb;
+} btn_port;
+
+/*
+ * Single producer (system workqueue), single consumer ring. head is only written
+ * by the producer and tail only by the consumer, so no lock is needed.
+ */
+typedef struct btn_event_queue_t {
+  btn_event events[BTN_EVENT_QUEUE_SIZE];
+  atomic_t head;
+  atomic_t tail;
+  btn_event_stats stats;
+} btn_event_queue;
+
+typedef struct btn_gesture_state_t {
+  bool armed; // The buttons are down and the hold is being timed
+  bool fired; // Already reported for this hold, wait for a release before firing again
+  uint32_t start; // Cycle count of the edge that armed the gesture, or of the first tap
+} btn_gesture_state;
+
+/*
+ * Gestures are only touched from the system workqueue (debounce and gesture timer),
+ * so they need no locking.
+ */
+typedef struct btn_gesture_engine_t {
+  const btn_gesture *table;
+  uint8_t count;
+  btn_gesture_callback cb;
+  btn_gesture_state state[BTN_GESTURE_MAX];
+  struct k_work_delayable timer;
+} btn_gesture_engine;
+
+typedef struct btn_init_state_t {
+  bool done; // BTN_init has run, later calls return rv
+  int rv;
+  uint32_t start; // Cycle counts around the first BTN_init
+  uint32_t end;
+} btn_init_state;
+
+#ifdef CONFIG_BTN_TRACE
+/*
+ * Written from the system workqueue only, keeps the most recent CONFIG_BTN_TRACE_DEPTH edges
+ */
+typedef struct btn_trace_t {
+  btn_trace_entry entries[CONFIG_BTN_TRACE_DEPTH];
+  uint32_t next; // Free running, total edges recorded since the trace was cleared
+  uint32_t start; // Cycle count entry times are relative to
+  bool recording;
+} btn_trace;
+#endif // CONFIG_BTN_TRACE
+
 /* ----------------------------------------------------------------------------
                             Private Function Prototypes
 ---------------------------------------------------------------------------- */
-static int _btn_config(btn_gpio *btn);
+static int _btn_init();
+
+static int _btn_sys_init();
+
+static int _btn_config(btn_id id);
+
+static int _btn_port_add(btn_id id);
 
 static void _btn_interrupt_service_routine(const struct device *dev, struct gpio_callback *cb, uint32_t pins);
 
 static void _btn_debounce(struct k_work *work);
 
+static void _btn_report(btn_gpio *btn, bool level);
+
+static void _btn_event_push(btn_gpio *btn, btn_edge edge);
+
+static void _btn_trace_record(btn_gpio *btn, btn_edge edge);
+
+static void _btn_gesture_edge(btn_gpio *btn, btn_edge edge);
+
+static void _btn_gesture_schedule();
+
+static void _btn_gesture_timeout(struct k_work *work);
+
+#ifdef CONFIG_BTN_INJECT
+static void _btn_inject_apply(struct k_work *work);
+#endif
+
 /* ----------------------------------------------------------------------------
                                 Global States
 ---------------------------------------------------------------------------- */
-static btn_gpio _btn0 = {.spec=GPIO_DT_SPEC_GET(BTN0_NODE, gpios), .pressed=false};
-static btn_gpio _btn1 = {.spec=GPIO_DT_SPEC_GET(BTN1_NODE, gpios), .pressed=false};
-static btn_gpio _btn2 = {.spec=GPIO_DT_SPEC_GET(BTN2_NODE, gpios), .pressed=false};
-static btn_gpio _btn3 = {.spec=GPIO_DT_SPEC_GET(BTN3_NODE, gpios), .pressed=false};
-static btn_gpio *_btns[NUM_BTNS] = {&_btn0, &_btn1, &_btn2, &_btn3};
+static const struct gpio_dt_spec _btn_specs[NUM_BTNS] = {
+  DT_FOREACH_CHILD_STATUS_OKAY(BTN_DT_PARENT, BTN_SPEC)
+};
+
+static btn_gpio _btns[NUM_BTNS];
+
+static btn_port _btn_ports[NUM_BTNS]; // Never more ports than buttons
+static uint8_t _btn_num_ports = 0;
+
+static btn_init_state _btn_init_state = {.done=false};
+
+static btn_callback _btn_cb = NULL;
+
+static btn_event_queue _btn_events = {.head=ATOMIC_INIT(0), .tail=ATOMIC_INIT(0)};
+K_SEM_DEFINE(_btn_event_sem, 0, BTN_EVENT_QUEUE_SIZE);
+
+static btn_gesture_engine _btn_gestures = {.count=0};
+
+// Debounced state of every button, BIT(BTNx) set while pressed. Only written by the debounce
+// work item, read from anywhere with a single load
+static atomic_t _btn_mask = ATOMIC_INIT(0);
+
+#ifdef CONFIG_BTN_TRACE
+static btn_trace _btn_trace = {.next=0, .recording=false};
+#endif
+
+#ifdef CONFIG_BTN_INJECT
+// Injected edges wait here for the system workqueue, the only context that reports edges
+K_MSGQ_DEFINE(_btn_inject_queue, sizeof(btn_event), BTN_EVENT_QUEUE_SIZE, 1);
+K_WORK_DEFINE(_btn_inject_work, _btn_inject_apply);
+#endif
 
 /* ----------------------------------------------------------------------------
                               Private Functions
 ---------------------------------------------------------------------------- */
+/**
+ * @brief Sets up the gesture timer, the trace and every button
+ * 
+ * @return Error code, < 0 on failures
+ */
+static int _btn_init() {
+  k_work_init_delayable(&_btn_gestures.timer, _btn_gesture_timeout);
+
+  // Record from boot so the edges leading up to a field report are already in the trace
+  BTN_trace_start();
+
+  for (uint8_t i = 0; i < NUM_BTNS; i++) {
+    int rv = _btn_config(i);
+    if (rv < 0) {
+      return rv;
+    }
+  }
+
+  for (uint8_t i = 0; i < _btn_num_ports; i++) {
+    gpio_init_callback(&_btn_ports[i].cb, _btn_interrupt_service_routine, _btn_ports[i].pins);
+    gpio_add_callback(_btn_ports[i].dev, &_btn_ports[i].cb);
+  }
+  return 0;
+}
+
+/**
+ * @brief Inits the buttons before main, so presses are debounced from the earliest point.
+ *        A failure is kept for main's own BTN_init call to report
+ * 
+ * @return Always 0
+ */
+static int _btn_sys_init() {
+  BTN_init();
+  return 0;
+}
+
 /**
  * @brief Configures a gpio spec as a button
  * 
- * @param [in] btn the btn_gpio object to configure
+ * @param [in] id the button to configure
  * 
  * @return Error code, < 0 on failures
  */
-static int _btn_config(btn_gpio *btn) {
-  if (!gpio_is_ready_dt(&btn->spec)) {
+static int _btn_config(btn_id id) {
+  const struct gpio_dt_spec *spec = &_btn_specs[id];
+  btn_gpio *btn = &_btns[id];
+
+  if (!gpio_is_ready_dt(spec)) {
 		return -EIO;
-	} else if (0 > gpio_pin_configure_dt(&btn->spec, GPIO_INPUT)) {
+	} else if (0 > gpio_pin_configure_dt(spec, GPIO_INPUT)) {
 		return -EIO;
-  } else if (0 > gpio_pin_interrupt_configure_dt(&btn->spec, GPIO_INT_EDGE_TO_ACTIVE)) {
+  } else if (0 > gpio_pin_interrupt_configure_dt(spec, GPIO_INT_EDGE_BOTH)) {
 		return -EIO;
   } else {
-    gpio_init_callback(&btn->cb, _btn_interrupt_service_routine, BIT(btn->spec.pin));
-    gpio_add_callback(btn->spec.port, &btn->cb);
+    btn->id = id;
+    btn->level = (0 < gpio_pin_get_dt(spec));
+    if (btn->level) {
+      atomic_or(&_btn_mask, BIT(id));
+    }
+#ifdef CONFIG_BTN_DEBOUNCE_INTEGRATOR
+    btn->integrator = btn->level ? BTN_INTEGRATOR_MAX : 0;
+#endif
     k_work_init_delayable(&btn->work, _btn_debounce);
-    return 0;
+    return _btn_port_add(id);
   }
 }
 
 /**
- * @brief Invoked as an interrupt when a button goes to the active state (high)
+ * @brief Adds a button to the pin table of its GPIO port, the first button on a port sets it up
+ * 
+ * @param [in] id the button to add
+ * 
+ * @return Error code, < 0 on failures
+ */
+static int _btn_port_add(btn_id id) {
+  const struct gpio_dt_spec *spec = &_btn_specs[id];
+  btn_port *port = NULL;
+
+  for (uint8_t i = 0; i < _btn_num_ports; i++) {
+    if (_btn_ports[i].dev == spec->port) {
+      port = &_btn_ports[i];
+      break;
+    }
+  }
+
+  if (!port) {
+    port = &_btn_ports[_btn_num_ports++];
+    port->dev = spec->port;
+    port->pins = 0;
+    memset(port->btn, BTN_NO_PIN, sizeof(port->btn));
+  }
+
+  if (BTN_NO_PIN != port->btn[spec->pin]) {
+    return -EINVAL; // Two buttons on one pin
+  }
+  port->btn[spec->pin] = id;
+  port->pins |= BIT(spec->pin);
+  return 0;
+}
+
+/**
+ * @brief Invoked as an interrupt when a button changes state, timestamps the first edge of a bounce
+ *        and hands the button to its debounce work item. Only the pins that fired are visited, each
+ *        maps straight to its button through the port's table
  * 
  * @param [in] dev The GPIO port that triggered the interrupt
  * @param [in] cb A pointer to the registered callback structure for this ISR
  * @param [in] pins A bitmask for all the GPIO pins that triggered this interrupt
  */
 static void _btn_interrupt_service_routine(const struct device *dev, struct gpio_callback *cb, uint32_t pins) {
-  for (uint8_t i = 0; i < NUM_BTNS; i++) {
-    if (pins & BIT(_btns[i]->spec.pin)) {
-      k_work_reschedule(&_btns[i]->work, K_MSEC(BTN_DEBOUNCE_MS));
+  btn_port *port = CONTAINER_OF(cb, btn_port, cb);
+
+  pins &= port->pins;
+  while (pins) {
+    uint8_t pin = find_lsb_set(pins) - 1;
+    btn_gpio *btn = &_btns[port->btn[pin]];
+
+    pins &= ~BIT(pin);
+#if defined(CONFIG_BTN_DEBOUNCE_LOCKOUT)
+    // Only the leading edge counts, the rest of the bounce lands inside the lockout
+    if (atomic_cas(&btn->locked, 0, 1)) {
+      btn->edge_timestamp = k_cycle_get_32();
+      k_work_reschedule(&btn->work, K_NO_WAIT);
+    }
+#elif defined(CONFIG_BTN_DEBOUNCE_INTEGRATOR)
+    // Already sampling until the count settles, more edges don't move the next sample
+    if (!k_work_delayable_is_pending(&btn->work)) {
+      btn->edge_timestamp = k_cycle_get_32();
+      k_work_schedule(&btn->work, K_NO_WAIT);
     }
+#else
+    if (!k_work_delayable_is_pending(&btn->work)) {
+      btn->edge_timestamp = k_cycle_get_32();
+    }
+    k_work_reschedule(&btn->work, K_MSEC(BTN_DEBOUNCE_MS));
+#endif
   }
   return;
 }
 
 /**
- * @brief Called once the button has been debounced, sets button pressed state
+ * @brief Runs the debounce strategy for a button that saw an edge, reports every change of
+ *        its debounced level
  * 
  * @param [in] work A k_work struct contained by a k_work_delayable inside a btn_gpio struct
  */
 static void _btn_debounce(struct k_work *_work) {
   struct k_work_delayable *dwork = CONTAINER_OF(_work, struct k_work_delayable, work);
   btn_gpio *btn = CONTAINER_OF(dwork, btn_gpio, work);
+  bool level = (0 < gpio_pin_get_dt(&_btn_specs[btn->id]));
+
+#if defined(CONFIG_BTN_DEBOUNCE_LOCKOUT)
+  // Runs for the leading edge and again at the end of every lockout it starts
+  if (level != btn->level) {
+    _btn_report(btn, level);
+    k_work_schedule(&btn->work, K_MSEC(BTN_DEBOUNCE_MS));
+    return;
+  }
+
+  atomic_clear(&btn->locked);
+
+  // An edge between the read and the unlock was ignored, check the pin once more. A change
+  // that landed inside the lockout is timed from here, its own first edge wasn't kept
+  if ((0 < gpio_pin_get_dt(&_btn_specs[btn->id])) != btn->level && atomic_cas(&btn->locked, 0, 1)) {
+    btn->edge_timestamp = k_cycle_get_32();
+    k_work_reschedule(&btn->work, K_NO_WAIT);
+  }
+#elif defined(CONFIG_BTN_DEBOUNCE_INTEGRATOR)
+  if (level && btn->integrator < BTN_INTEGRATOR_MAX) {
+    btn->integrator++;
+  } else if (!level && btn->integrator > 0) {
+    btn->integrator--;
+  }
+
+  if (btn->integrator == (btn->level ? 0 : BTN_INTEGRATOR_MAX)) {
+    _btn_report(btn, !btn->level);
+    btn->reported = true;
+  }
+
+  if (btn->integrator != (btn->level ? BTN_INTEGRATOR_MAX : 0)) {
+    k_work_schedule(&btn->work, K_MSEC(CONFIG_BTN_DEBOUNCE_SAMPLE_MS));
+    return;
+  }
+
+  // Settled, a count that went back without reporting was a glitch shorter than the debounce time
+  if (!btn->reported) {
+    _btn_events.stats.dropped++;
+  }
+  btn->reported = false;
+#else
+  if (level == btn->level) {
+    // Bounced back to where it started, a press/release pair was lost inside the debounce time
+    _btn_events.stats.dropped++;
+    return;
+  }
 
-  if (gpio_pin_get_dt(&btn->spec)) {
+  _btn_report(btn, level);
+#endif
+}
+
+/**
+ * @brief Records a new debounced level, sets the pressed flag, queues an event and feeds the
+ *        trace, the gestures and the callback
+ * 
+ * @param [in] btn The button that changed
+ * @param [in] level Its new debounced level, true when pressed
+ */
+static void _btn_report(btn_gpio *btn, bool level) {
+  btn->level = level;
+  if (level) {
+    atomic_or(&_btn_mask, BIT(btn->id));
+  } else {
+    atomic_and(&_btn_mask, ~BIT(btn->id));
+  }
+  _btn_events.stats.reported++;
+  if (level) {
     btn->pressed = true;
   }
+  _btn_event_push(btn, level ? BTN_EDGE_PRESS : BTN_EDGE_RELEASE);
+  _btn_trace_record(btn, level ? BTN_EDGE_PRESS : BTN_EDGE_RELEASE);
+  _btn_gesture_edge(btn, level ? BTN_EDGE_PRESS : BTN_EDGE_RELEASE);
+
+  if (_btn_cb) {
+    _btn_cb(btn->id);
+  }
+}
+
+/**
+ * @brief Adds an event to the event queue, drops it if the queue is full
+ * 
+ * @param [in] btn The button that changed
+ * @param [in] edge The edge that was debounced
+ */
+static void _btn_event_push(btn_gpio *btn, btn_edge edge) {
+  atomic_val_t head = atomic_get(&_btn_events.head);
+
+  if (head - atomic_get(&_btn_events.tail) >= BTN_EVENT_QUEUE_SIZE) {
+    _btn_events.stats.overflow++;
+    return;
+  }
+
+  btn_event *evt = &_btn_events.events[head & BTN_EVENT_QUEUE_MASK];
+  evt->btn = btn->id;
+  evt->edge = edge;
+  evt->timestamp = btn->edge_timestamp;
+
+  atomic_set(&_btn_events.head, head + 1);
+  k_sem_give(&_btn_event_sem);
+}
+
+/**
+ * @brief Appends a debounced edge to the trace while recording, overwriting the oldest once full
+ * 
+ * @param [in] btn The button that changed
+ * @param [in] edge The edge that was debounced
+ */
+static void _btn_trace_record(btn_gpio *btn, btn_edge edge) {
+#ifdef CONFIG_BTN_TRACE
+  if (!_btn_trace.recording) {
+    return;
+  }
+
+  btn_trace_entry *entry = &_btn_trace.entries[_btn_trace.next++ % CONFIG_BTN_TRACE_DEPTH];
+  entry->time_us = k_cyc_to_us_floor32(btn->edge_timestamp - _btn_trace.start);
+  entry->btn = btn->id;
+  entry->edge = edge;
+#endif
+}
+
+/**
+ * @brief Feeds a debounced edge to every registered gesture. Chords and long presses are armed
+ *        here and completed by the gesture timer, double taps complete on their second press
+ * 
+ * @param [in] btn The button that changed
+ * @param [in] edge The edge that was debounced
+ */
+static void _btn_gesture_edge(btn_gpio *btn, btn_edge edge) {
+  uint32_t mask = (uint32_t)atomic_get(&_btn_mask);
+
+  for (uint8_t i = 0; i < _btn_gestures.count; i++) {
+    const btn_gesture *gesture = &_btn_gestures.table[i];
+    btn_gesture_state *state = &_btn_gestures.state[i];
+    bool held;
+
+    switch (gesture->type) {
+      case BTN_GESTURE_CHORD:
+        held = (gesture->mask == (mask & gesture->mask));
+        break;
+      case BTN_GESTURE_LONG_PRESS:
+        held = (gesture->mask == mask);
+        break;
+      case BTN_GESTURE_DOUBLE_TAP:
+        if (BTN_EDGE_PRESS != edge || !(gesture->mask & BIT(btn->id))) {
+          continue;
+        } else if (state->armed && (btn->edge_timestamp - state->start) <= k_ms_to_cyc_ceil32(gesture->time_ms)) {
+          state->armed = false;
+          _btn_gestures.cb(i);
+        } else {
+          state->armed = true;
+          state->start = btn->edge_timestamp;
+        }
+        continue;
+      default:
+        continue;
+    }
+
+    if (!held) {
+      state->armed = false;
+      state->fired = false;
+    } else if (!state->armed && !state->fired) {
+      state->armed = true;
+      state->start = btn->edge_timestamp;
+    }
+  }
+
+  _btn_gesture_schedule();
+}
+
+/**
+ * @brief Arms the gesture timer for the earliest hold that hasn't completed yet, stops it if none
+ */
+static void _btn_gesture_schedule() {
+  uint32_t now = k_cycle_get_32();
+  int32_t next = INT32_MAX;
+
+  for (uint8_t i = 0; i < _btn_gestures.count; i++) {
+    const btn_gesture *gesture = &_btn_gestures.table[i];
+    btn_gesture_state *state = &_btn_gestures.state[i];
+
+    if (state->armed && BTN_GESTURE_DOUBLE_TAP != gesture->type) {
+      int32_t remaining = (int32_t)(state->start + k_ms_to_cyc_ceil32(gesture->time_ms) - now);
+      next = MIN(next, MAX(remaining, 0));
+    }
+  }
+
+  if (INT32_MAX == next) {
+    k_work_cancel_delayable(&_btn_gestures.timer);
+  } else {
+    k_work_reschedule(&_btn_gestures.timer, K_CYC(next));
+  }
+}
+
+/**
+ * @brief Fires every held gesture whose hold time has passed since the edge that armed it
+ * 
+ * @param [in] work Unused, the gesture timer's work item
+ */
+static void _btn_gesture_timeout(struct k_work *work __attribute__((unused))) {
+  uint32_t now = k_cycle_get_32();
+
+  for (uint8_t i = 0; i < _btn_gestures.count; i++) {
+    const btn_gesture *gesture = &_btn_gestures.table[i];
+    btn_gesture_state *state = &_btn_gestures.state[i];
+
+    if (state->armed && BTN_GESTURE_DOUBLE_TAP != gesture->type
+        && (now - state->start) >= k_ms_to_cyc_ceil32(gesture->time_ms)) {
+      state->armed = false;
+      state->fired = true;
+      _btn_gestures.cb(i);
+    }
+  }
+
+  _btn_gesture_schedule();
+}
+
+#ifdef CONFIG_BTN_INJECT
+/**
+ * @brief Reports every injected edge as if it had been debounced, edges that don't change
+ *        the button's level are counted as dropped
+ * 
+ * @param [in] work Unused, the inject work item
+ */
+static void _btn_inject_apply(struct k_work *work __attribute__((unused))) {
+  btn_event evt;
+
+  while (0 == k_msgq_get(&_btn_inject_queue, &evt, K_NO_WAIT)) {
+    btn_gpio *btn = &_btns[evt.btn];
+    bool level = (BTN_EDGE_PRESS == evt.edge);
+
+    if (level == btn->level) {
+      _btn_events.stats.dropped++;
+      continue;
+    }
+
+    btn->edge_timestamp = evt.timestamp;
+#ifdef CONFIG_BTN_DEBOUNCE_INTEGRATOR
+    btn->integrator = level ? BTN_INTEGRATOR_MAX : 0;
+#endif
+    _btn_report(btn, level);
+  }
 }
+#endif // CONFIG_BTN_INJECT
 
 /* ----------------------------------------------------------------------------
                               Public Functions
 ---------------------------------------------------------------------------- */
 /**
- * @brief Inits all buttons
+ * @brief Inits all buttons. Already run from SYS_INIT before main, calling it again only
+ *        returns the result of that first run
  * 
  * @return Error code, < 0 on failures
  */
 int BTN_init() {
-  for (uint8_t i = 0; i < NUM_BTNS; i++) {
-    int rv = _btn_config(_btns[i]);
-    if (rv < 0) {
-      return rv;
-    }
+  if (_btn_init_state.done) {
+    return _btn_init_state.rv;
   }
-  return 0;
+
+  _btn_init_state.start = k_cycle_get_32();
+  _btn_init_state.rv = _btn_init();
+  _btn_init_state.end = k_cycle_get_32();
+  _btn_init_state.done = true;
+  return _btn_init_state.rv;
+}
+
+/**
+ * @brief Gets when the first BTN_init ran, for boot profiling
+ * 
+ * @param [out] start k_cycle_get_32() when it started
+ * @param [out] end k_cycle_get_32() when it returned
+ * 
+ * @return true if BTN_init has run
+ */
+bool BTN_get_init_cycles(uint32_t *start, uint32_t *end) {
+  *start = _btn_init_state.start;
+  *end = _btn_init_state.end;
+  return _btn_init_state.done;
 }
 
 /**
@@ -136,13 +631,49 @@ int BTN_init() {
 bool BTN_is_pressed(btn_id btn) {
   if (IS_INVALID_BTN(btn)) {
     return false;
-  } else if (0 < gpio_pin_get_dt(&_btns[btn]->spec)) {
+  } else if (0 < gpio_pin_get_dt(&_btn_specs[btn])) {
     return true;
   } else {
     return false;
   }
 }
 
+/**
+ * @brief Gets the debounced state of every button
+ * 
+ * @return BIT(BTNx) set for every button that is pressed
+ */
+uint32_t BTN_get_mask() {
+  return (uint32_t)atomic_get(&_btn_mask);
+}
+
+/**
+ * @brief Reads the undebounced state of every button straight from the pins, with one port
+ *        read per GPIO port instead of one call per button
+ * 
+ * @return BIT(BTNx) set for every button whose pin is active, 0 for a port that can't be read
+ */
+uint32_t BTN_get_raw_mask() {
+  uint32_t mask = 0;
+
+  for (uint8_t i = 0; i < _btn_num_ports; i++) {
+    const btn_port *port = &_btn_ports[i];
+    gpio_port_value_t value;
+
+    if (0 > gpio_port_get(port->dev, &value)) {
+      continue;
+    }
+
+    value &= port->pins;
+    while (value) {
+      uint8_t pin = find_lsb_set(value) - 1;
+      value &= ~BIT(pin);
+      mask |= BIT(port->btn[pin]);
+    }
+  }
+  return mask;
+}
+
 /**
  * @brief Checks if the given button has been pressed, clears internal state flag.
  *        Equivalent to calling BTN_check_pressed(BTNx) then calling BTN_clear_pressed(BTNx)
@@ -155,8 +686,8 @@ bool BTN_check_clear_pressed(btn_id btn) {
   if (IS_INVALID_BTN(btn)) {
     return false;
   } else {
-    bool was_pressed = _btns[btn]->pressed;
-    _btns[btn]->pressed = false;
+    bool was_pressed = _btns[btn].pressed;
+    _btns[btn].pressed = false;
     return was_pressed;
   }
 }
@@ -172,7 +703,7 @@ bool BTN_check_pressed(btn_id btn) {
   if (IS_INVALID_BTN(btn)) {
     return false;
   } else {
-    return _btns[btn]->pressed;
+    return _btns[btn].pressed;
   }
 }
 
@@ -185,7 +716,209 @@ void BTN_clear_pressed(btn_id btn) {
   if (IS_INVALID_BTN(btn)) {
     return;
   } else {
-    _btns[btn]->pressed = false;
+    _btns[btn].pressed = false;
     return;
   }
 }
+
+/**
+ * @brief Registers a function to be notified each time a button event is queued.
+ *        The callback runs from the system workqueue, pass NULL to unregister
+ * 
+ * @param [in] cb The function to call with the id of the pressed button
+ */
+void BTN_set_callback(btn_callback cb) {
+  _btn_cb = cb;
+}
+
+/**
+ * @brief Takes the oldest button event from the event queue without blocking
+ * 
+ * @param [out] evt Filled with the oldest event
+ * 
+ * @return 0 on success, -EAGAIN if there are no events
+ */
+int BTN_get_event(btn_event *evt) {
+  atomic_val_t tail = atomic_get(&_btn_events.tail);
+
+  if (tail == atomic_get(&_btn_events.head)) {
+    return -EAGAIN;
+  }
+
+  *evt = _btn_events.events[tail & BTN_EVENT_QUEUE_MASK];
+  atomic_set(&_btn_events.tail, tail + 1);
+  return 0;
+}
+
+/**
+ * @brief Takes the oldest button event from the event queue, waiting for one if empty
+ * 
+ * @param [out] evt Filled with the oldest event
+ * @param [in] timeout How long to wait for an event
+ * 
+ * @return 0 on success, -EAGAIN if no event arrived before the timeout
+ */
+int BTN_wait_event(btn_event *evt, k_timeout_t timeout) {
+  // The semaphore count can run ahead of the queue when BTN_get_event is also used
+  while (0 != BTN_get_event(evt)) {
+    if (0 != k_sem_take(&_btn_event_sem, timeout)) {
+      return -EAGAIN;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Gets the event queue counters
+ * 
+ * @param [out] stats Filled with the current counters
+ */
+void BTN_get_event_stats(btn_event_stats *stats) {
+  *stats = _btn_events.stats;
+  stats->queued = atomic_get(&_btn_events.head) - atomic_get(&_btn_events.tail);
+#ifdef CONFIG_BTN_INJECT
+  stats->queued += k_msgq_num_used_get(&_btn_inject_queue);
+#endif
+}
+
+/**
+ * @brief Feeds an edge into the driver as if the button had been pressed or released. It
+ *        skips the pin and the debouncer but takes the same path from there on, so events,
+ *        the trace, gestures and the callback all see it. Safe to call from any thread or ISR
+ * 
+ * @param [in] btn The button that changed
+ * @param [in] edge The edge it changed with
+ * 
+ * @return Error code, < 0 on failures (-ENOTSUP without CONFIG_BTN_INJECT, -ENOMSG if full)
+ */
+int BTN_inject(btn_id btn, btn_edge edge) {
+#ifdef CONFIG_BTN_INJECT
+  if (IS_INVALID_BTN(btn)) {
+    return -EINVAL;
+  }
+
+  btn_event evt = {.btn=btn, .edge=edge, .timestamp=k_cycle_get_32()};
+  int rv = k_msgq_put(&_btn_inject_queue, &evt, K_NO_WAIT);
+  if (rv < 0) {
+    return -ENOMSG;
+  }
+
+  k_work_submit(&_btn_inject_work);
+  return 0;
+#else
+  return -ENOTSUP;
+#endif
+}
+
+/**
+ * @brief Registers a table of gestures to watch for, replacing any previous table.
+ *        Each gesture fires the callback once, with its index in the table, when it completes.
+ *        Holds are timed from the debounced edge timestamps, the callback runs from the system workqueue
+ * 
+ * @param [in] table The gestures to recognize, must stay valid while registered
+ * @param [in] count Number of entries in table, 0 to stop recognizing gestures
+ * @param [in] cb The function to call when a gesture completes
+ * 
+ * @return Error code, < 0 on failures
+ */
+int BTN_gesture_register(const btn_gesture *table, uint8_t count, btn_gesture_callback cb) {
+  if (count > BTN_GESTURE_MAX || (count && (!table || !cb))) {
+    return -EINVAL;
+  }
+
+  k_work_cancel_delayable(&_btn_gestures.timer);
+  _btn_gestures.count = 0;
+  memset(_btn_gestures.state, 0, sizeof(_btn_gestures.state));
+  _btn_gestures.table = table;
+  _btn_gestures.cb = cb;
+  _btn_gestures.count = count;
+
+  return 0;
+}
+
+/**
+ * @brief Clears the button trace and starts recording every debounced edge into it.
+ *        Entry times are relative to this call. Does nothing without CONFIG_BTN_TRACE
+ */
+void BTN_trace_start() {
+#ifdef CONFIG_BTN_TRACE
+  _btn_trace.recording = false;
+  _btn_trace.next = 0;
+  _btn_trace.start = k_cycle_get_32();
+  _btn_trace.recording = true;
+#endif
+}
+
+/**
+ * @brief Stops recording, the trace is kept until the next BTN_trace_start
+ */
+void BTN_trace_stop() {
+#ifdef CONFIG_BTN_TRACE
+  _btn_trace.recording = false;
+#endif
+}
+
+/**
+ * @brief Copies the recorded edges, oldest first
+ * 
+ * @param [out] buf Filled with the oldest edges still in the trace
+ * @param [in] len Size of buf
+ * 
+ * @return Number of entries copied into buf
+ */
+uint32_t BTN_trace_read(btn_trace_entry *buf, uint32_t len) {
+#ifdef CONFIG_BTN_TRACE
+  uint32_t count = MIN(_btn_trace.next, CONFIG_BTN_TRACE_DEPTH);
+  uint32_t first = _btn_trace.next - count;
+
+  count = MIN(count, len);
+  for (uint32_t i = 0; i < count; i++) {
+    buf[i] = _btn_trace.entries[(first + i) % CONFIG_BTN_TRACE_DEPTH];
+  }
+  return count;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Prints the recorded edges, oldest first, one C initializer per line so a dump can
+ *        be pasted straight into a replay trace file
+ */
+void BTN_trace_dump() {
+#ifdef CONFIG_BTN_TRACE
+  uint32_t count = MIN(_btn_trace.next, CONFIG_BTN_TRACE_DEPTH);
+
+  printk("/* btn trace: %" PRIu32 " of %" PRIu32 " edges, {time_us, btn, edge} */\n", count, _btn_trace.next);
+  for (uint32_t i = _btn_trace.next - count; i < _btn_trace.next; i++) {
+    const btn_trace_entry *entry = &_btn_trace.entries[i % CONFIG_BTN_TRACE_DEPTH];
+    printk("{%" PRIu32 ", %u, %u},\n", entry->time_us, entry->btn, entry->edge);
+  }
+#endif
+}
+
+SYS_INIT(_btn_sys_init, APPLICATION, CONFIG_BTN_INIT_PRIORITY);
+
+/* ----------------------------------------------------------------------------
+                                Shell Commands
+---------------------------------------------------------------------------- */
+#if defined(CONFIG_BTN_TRACE) && defined(CONFIG_SHELL)
+
+static int _btn_cmd_trace(const struct shell *sh, size_t argc, char **argv) {
+  BTN_trace_dump();
+  return 0;
+}
+
+static int _btn_cmd_restart(const struct shell *sh, size_t argc, char **argv) {
+  BTN_trace_start();
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(_btn_cmds,
+  SHELL_CMD(trace, NULL, "Dump the recorded button edges", _btn_cmd_trace),
+  SHELL_CMD(restart, NULL, "Clear the button trace and record from now on", _btn_cmd_restart),
+  SHELL_SUBCMD_SET_END
+);
+SHELL_CMD_REGISTER(btn, &_btn_cmds, "Button edge trace", NULL);
+
+#endif // CONFIG_BTN_TRACE && CONFIG_SHELL
@@ -6,16 +6,26 @@ Header to define led interface
 #define LED_H
 
 #include "stdint.h"
+#include <stdbool.h>
+#include <zephyr/devicetree.h>
+
+#define LED_MAX_DUTY_CYCLE  100 // Duty cycles are given as a percentage, 0 - 100
+
+/* ----------------------------------------------------------------------------
+                                  Macro Helpers
+---------------------------------------------------------------------------- */
+#define LED_DT_PARENT       DT_PARENT(DT_ALIAS(pwm_led0)) // The pwm-leds node, every enabled child is an LED
+#define NUM_LEDS            DT_CHILD_NUM_STATUS_OKAY(LED_DT_PARENT)
 
 /* ----------------------------------------------------------------------------
                                     TYPES
 ---------------------------------------------------------------------------- */
+// LEDs are numbered in devicetree order, boards with more than four use plain indices past LED3
 typedef enum led_id_t {
   LED0 = 0,
   LED1,
   LED2,
   LED3,
-  NUM_LEDS,
 } led_id;
 
 typedef enum led_state_t {
@@ -31,17 +41,73 @@ typedef enum led_frequency_t {
   LED_16HZ = 16,
 } led_frequency;
 
+typedef enum led_curve_t {
+  LED_CURVE_LINEAR = 0, // Duty cycle follows the level directly
+  LED_CURVE_GAMMA, // Gamma corrected so brightness changes look even to the eye
+} led_curve;
+
+typedef struct led_step_t {
+  uint16_t duration_ms; // How long the step is held, 0 counts as 1
+  uint8_t duty_cycle; // Valid from 0 - 100
+} led_step;
+
+typedef struct led_pattern_t {
+  const led_step *steps; // Must stay valid while the pattern plays
+  uint16_t count;
+  bool loop; // Start over after the last step instead of holding it
+} led_pattern;
+
+typedef struct led_pm_stats_t {
+  uint32_t suspends; // Times every LED went idle and the PWM controller was released
+  uint32_t resumes; // Times an LED lit up or started animating while the controller was released
+} led_pm_stats;
+
+typedef struct led_cmd_stats_t {
+  uint32_t overflows; // Commands and frames dropped because an LED's command ring was full
+  uint32_t write_errors; // PWM writes that failed in the LED owner
+} led_cmd_stats;
+
+typedef void (*led_observer)(led_id led, uint8_t duty_cycle);
+
+typedef void (*led_done_callback)(led_id led);
+
 /* ----------------------------------------------------------------------------
                               Public Functions
 ---------------------------------------------------------------------------- */
 int LED_init();
 
+bool LED_get_init_cycles(uint32_t *start, uint32_t *end);
+
 int LED_toggle(led_id led);
 
 int LED_set(led_id led, led_state new_state);
 
 int LED_pwm(led_id led, uint8_t duty_cycle);
 
+uint8_t LED_get_pwm(led_id led);
+
 void LED_blink(led_id led, led_frequency frequency);
 
+int LED_frame_set(uint32_t mask, const uint8_t duty[NUM_LEDS]);
+
+int LED_frame_commit();
+
+int LED_fade(led_id led, uint8_t target, uint16_t duration_ms, led_curve curve);
+
+int LED_breathe(led_id led, uint8_t min, uint8_t max, uint16_t period_ms, led_curve curve);
+
+int LED_play(led_id led, const led_pattern *pattern);
+
+int LED_morse(const char *text, uint16_t unit_ms, led_step *steps, uint16_t max_steps);
+
+void LED_get_pm_stats(led_pm_stats *stats);
+
+void LED_get_cmd_stats(led_cmd_stats *stats);
+
+uint32_t LED_get_seq_mask();
+
+void LED_set_observer(led_observer cb);
+
+void LED_set_done_callback(led_done_callback cb);
+
 #endif
\ No newline at end of file
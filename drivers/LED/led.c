@@ -1,79 +1,498 @@
 /*
 Header to define led module logic
+
+Every LED is owned by the anim timer's work item on the system workqueue, which is the only
+context that touches the PWM channels, the animations and the cached duty cycles. Public
+calls queue their request on the LED's command ring, the owner applies every queued command
+in order the next time it runs. Duty cycles and write errors are published back with atomics,
+so callers from any thread or ISR never wait on the owner and never race the animations.
+
+On nRF PWM controllers blinks can be handed to the peripheral (CONFIG_LED_BLINK_HW_SEQ):
+while every animated LED is blinking at 1, 2, 4, 8 or 16 Hz, the owner loads a looping one
+second EasyDMA sequence with every channel's blink and steady level, at the PWM driver's own
+period, and the CPU isn't woken for the toggles at all. Any fade, pattern or other frequency
+hands them back to the anim timer, and the controller goes back to the PWM driver.
 */
 
 #include <zephyr/kernel.h>
+#include <zephyr/init.h>
 #include <zephyr/drivers/pwm.h>
+#include <zephyr/pm/device_runtime.h>
+#include <zephyr/shell/shell.h>
 #include <inttypes.h>
+#ifdef CONFIG_LED_BLINK_HW_SEQ
+#include <hal/nrf_pwm.h>
+#endif
 
 #include "LED.h"
 
 /* ----------------------------------------------------------------------------
                                     Constants
 ---------------------------------------------------------------------------- */
-#define LED_BLINK_STACK_SIZE      384
-#define LED_BLINK_PRIORITY        1
-#define LED_COUNTER_UNIT          100 // Units per ms (1 unit == 10us)
-#define LED_COUNTER_HALF_PERIOD   500 * LED_COUNTER_UNIT // Units per half second (1 second / 2 == 500ms)
+#define LED_HALF_SECOND_US        500000 // A 1Hz blink toggles every half second
+#define LED_FADE_STEP_MS          20 // One PWM period, finer steps would never reach the LED
+
+#define PWM_MAX_DUTY_CYCLE        LED_MAX_DUTY_CYCLE // Valid duty cycle range for this application is 0 - 100
+#define PWM_DUTY_SCALE            10000 // Fine duty cycle units used for fades (1 unit == 0.01%)
+
+#define LED_MORSE_DASH            3 // Units a dash is on
+#define LED_MORSE_CHAR_GAP        3 // Units off between characters
+#define LED_MORSE_WORD_GAP        7 // Units off between words
 
-#define PWM_MAX_DUTY_CYCLE        100 // Valid duty cycle range for this application is 0 - 100
+#define LED_CMD_QUEUE_SIZE        CONFIG_LED_CMD_QUEUE_SIZE
+
+#define LED_SEQ_STEPS             32 // One second, looped. Blinks at frequencies dividing 16 fit whole
+#define LED_SEQ_STEP_NS           31250000 // Each step is held for a whole number of PWM periods
+#define LED_SEQ_POLARITY          BIT(15) // Sequence value flag for outputs that start high
 
 /* ----------------------------------------------------------------------------
                                   Macro Helpers
 ---------------------------------------------------------------------------- */
-#define LED0_NODE             DT_ALIAS(pwm_led0)
-#define LED1_NODE             DT_ALIAS(pwm_led1)
-#define LED2_NODE             DT_ALIAS(pwm_led2)
-#define LED3_NODE             DT_ALIAS(pwm_led3)
+#define LED_SPEC(node_id)     PWM_DT_SPEC_GET(node_id),
 
 #define IS_INVALID_LED(led)   (led >= NUM_LEDS || led < 0)
 
+#define LED_SEQ_PWM_NODE      DT_PWMS_CTLR(DT_ALIAS(pwm_led0))
+
+// The sequence is only played on an nRF PWM controller, anything else blinks from the anim timer
+#if defined(CONFIG_LED_BLINK_HW_SEQ) && DT_NODE_HAS_COMPAT(LED_SEQ_PWM_NODE, nordic_nrf_pwm)
+#define LED_HW_SEQ
+#define LED_SEQ_MASK          (_led_seq.hw_mask)
+#else
+#define LED_SEQ_MASK          0
+#endif
+
+BUILD_ASSERT(NUM_LEDS > 0 && NUM_LEDS <= 32, "LED masks are 32 bits wide");
+BUILD_ASSERT(IS_POWER_OF_TWO(LED_CMD_QUEUE_SIZE) && LED_CMD_QUEUE_SIZE <= 128,
+  "ring indices are free running uint8_t");
+
+#define LED_LEVEL(duty_cycle) ((uint16_t)(duty_cycle) << 8) // Duty cycle to Q8 fade level
+
 /* ----------------------------------------------------------------------------
                                     Types
 ---------------------------------------------------------------------------- */
+typedef enum led_anim_t {
+  LED_ANIM_BLINK = 0,
+  LED_ANIM_FADE,
+  LED_ANIM_PATTERN,
+} led_anim;
+
+typedef enum led_cmd_type_t {
+  LED_CMD_NONE = 0,
+  LED_CMD_PWM,
+  LED_CMD_TOGGLE,
+  LED_CMD_BLINK,
+  LED_CMD_FADE,
+  LED_CMD_BREATHE,
+  LED_CMD_PLAY,
+} led_cmd_type;
+
+typedef struct led_cmd_t {
+  uint32_t type : 3; // One of led_cmd_type
+  uint32_t curve : 1; // One of led_curve, fades and breathing only
+  uint32_t a : 7; // Duty cycle, blink frequency, fade target or breathing minimum
+  uint32_t b : 7; // Breathing maximum
+  uint32_t steps : 14; // Fade steps, or steps per half breath
+  const led_pattern *pattern; // LED_CMD_PLAY only
+} led_cmd;
+
+/*
+ * Commands posted for one LED, in order. Producers fill it under _led_cmd_lock, the owner
+ * reads the entries it was handed without the lock since producers never touch them
+ */
+typedef struct led_cmd_ring_t {
+  led_cmd cmds[LED_CMD_QUEUE_SIZE];
+  uint8_t head; // Free running, next entry to fill
+  uint8_t tail; // Free running, next entry for the owner
+} led_cmd_ring;
+
 typedef struct led_blink_t {
-  uint16_t half_period; // Units of 10us
-  uint16_t offset; // Units of 10us
+  k_ticks_t half_period; // Kernel ticks between toggles
+  uint8_t frequency; // One of led_frequency
+  uint8_t level; // Duty cycle of the first half period while the sequence plays the blink
 } led_blink;
 
+typedef struct led_fade_t {
+  uint16_t from; // Q8 level, 0 - (100 << 8)
+  uint16_t to; // Q8 level, 0 - (100 << 8)
+  uint16_t step;
+  uint16_t steps;
+  uint8_t curve; // One of led_curve
+  bool loop; // Swap from and to at the end of each fade instead of stopping
+} led_fade;
+
+typedef struct led_play_t {
+  const led_pattern *pattern;
+  uint16_t step; // Index of the step being shown
+} led_play;
+
+/*
+ * Runtime state of an LED, its channel lives in the matching entry of _led_specs. Only the
+ * command ring, the published duty cycle and the error are touched outside the owner
+ */
 typedef struct led_t {
-  struct pwm_dt_spec spec; 
+  led_cmd_ring ring;
+  atomic_t published_duty_cycle; // Copy of current_duty_cycle for readers outside the owner
+  atomic_t error; // Last failed PWM write not yet returned to a caller, 0 if none
+  uint8_t anim; // One of led_anim, only valid while the LED's bit is set in the anim timer
+  k_ticks_t next_update; // Absolute uptime in kernel ticks of the next blink toggle or fade step
   led_blink blink;
+  led_fade fade;
+  led_play play;
   uint8_t current_duty_cycle; // Valid from 0 - 100
+  bool powered; // Holds a runtime PM reference on the PWM controller
 } led_type;
 
-typedef struct blink_thread_t {
-  struct k_thread thread;
-  k_tid_t id;
-  uint8_t led_bitmask;
-} blink_thread;
+typedef struct led_frame_t {
+  uint32_t mask; // LEDs staged for the next commit
+  uint8_t duty[NUM_LEDS]; // Valid from 0 - 100
+} led_frame;
+
+/*
+ * The LED owner, runs for every animation deadline and whenever a command is posted
+ */
+typedef struct anim_timer_t {
+  struct k_work_delayable work;
+  uint32_t led_bitmask; // LEDs that are blinking or fading
+} anim_timer;
+
+#ifdef LED_HW_SEQ
+/*
+ * The PWM driver's playback registers, put back when the sequence stops
+ */
+typedef struct led_seq_regs_t {
+  uint32_t decoder;
+  uint32_t loop;
+  uint32_t shorts;
+  uint32_t ptr[2];
+  uint32_t cnt[2];
+  uint32_t refresh[2];
+  uint32_t enddelay[2];
+} led_seq_regs;
+
+/*
+ * The looping sequence on the LEDs' PWM controller, owned by the LED owner. EasyDMA reads the
+ * values straight from RAM, so a steady channel is changed by rewriting its column
+ */
+typedef struct led_seq_t {
+  uint16_t values[LED_SEQ_STEPS][NRF_PWM_CHANNEL_COUNT]; // One value per channel per step
+  NRF_PWM_Type *pwm;
+  bool usable; // Every LED is on this controller, with one period that divides LED_SEQ_STEP_NS
+  bool playing; // The controller is the sequence's until a stop has completed
+  bool stopping; // STOP was triggered, the STOPPED event hasn't been seen yet
+  uint32_t hw_mask; // LEDs whose blink the sequence plays
+  k_ticks_t start; // Uptime the sequence was last started at, in kernel ticks
+  k_ticks_t stop_check; // Uptime to look for the STOPPED event at, in kernel ticks
+  k_ticks_t period; // One PWM period in kernel ticks, rounded up
+  uint32_t refresh; // Extra PWM periods every step is held for
+  uint16_t top; // The PWM driver's COUNTERTOP, the sequence keeps its period
+  led_seq_regs saved;
+} led_seq;
+#endif
+
+typedef struct led_pm_t {
+  uint8_t users; // LEDs that are lit or animated
+  led_pm_stats stats;
+} led_pm;
+
+typedef struct led_init_state_t {
+  bool done; // LED_init has run, later calls return rv
+  int rv;
+  uint32_t start; // Cycle counts around the first LED_init
+  uint32_t end;
+} led_init_state;
 
 /* ----------------------------------------------------------------------------
                             Private Function Prototypes
 ---------------------------------------------------------------------------- */
+static int _led_init();
+
+static int _led_sys_init();
+
+static void _led_pm_claim(led_id led);
+
+static void _led_pm_release(led_id led);
+
+static int _led_write_channel(led_id led, uint16_t duty);
+
+static int _led_write(led_id led, uint16_t duty);
+
+static void _led_toggle(led_id led);
+
 static int _led_pwm_preserve_blink(led_id led, uint8_t duty_cycle);
 
+static int _led_write_level(led_id led, uint16_t level, led_curve curve);
+
 static void _led_halt_blink(led_id led);
 
-static void _led_blink_loop(void *led, void *p2, void *p3);
+static void _led_start_anim(led_id led, led_anim anim, k_ticks_t first_update);
+
+static void _led_anim_done(led_id led);
+
+static void _led_fade_step(led_id led);
+
+static void _led_pattern_write(led_id led, k_ticks_t start);
+
+static void _led_pattern_step(led_id led);
+
+#ifdef LED_HW_SEQ
+static uint16_t _led_seq_value(led_id led, uint16_t duty);
+
+static void _led_seq_fill(led_id led, uint16_t first, uint16_t second, uint8_t half_steps);
+
+static void _led_seq_release(led_id led, k_ticks_t now);
+
+static void _led_seq_save();
+
+static void _led_seq_restore();
+
+static void _led_seq_stop(k_ticks_t now);
+
+static void _led_seq_stopped(k_ticks_t now);
+
+static void _led_seq_update(k_ticks_t now);
+#endif
+
+static void _led_apply(led_id led, const led_cmd *cmd);
+
+static bool _led_ring_push(led_id led, const led_cmd *cmd);
+
+static void _led_anim_schedule();
+
+static void _led_anim_handler(struct k_work *work);
+
+static int _led_post(led_id led, led_cmd cmd);
 
 /* ----------------------------------------------------------------------------
                                 Global States
 ---------------------------------------------------------------------------- */
-static led_type _led0 = {.spec=PWM_DT_SPEC_GET(LED0_NODE), .current_duty_cycle=0};
-static led_type _led1 = {.spec=PWM_DT_SPEC_GET(LED1_NODE), .current_duty_cycle=0};
-static led_type _led2 = {.spec=PWM_DT_SPEC_GET(LED2_NODE), .current_duty_cycle=0};
-static led_type _led3 = {.spec=PWM_DT_SPEC_GET(LED3_NODE), .current_duty_cycle=0};
-static led_type *_leds[NUM_LEDS] = {&_led0, &_led1, &_led2, &_led3};
+static const struct pwm_dt_spec _led_specs[NUM_LEDS] = {
+  DT_FOREACH_CHILD_STATUS_OKAY(LED_DT_PARENT, LED_SPEC)
+};
+
+static led_type _leds[NUM_LEDS];
+
+static anim_timer _led_anim_timer = {.led_bitmask=0};
+
+static led_frame _led_frame = {.mask=0};
+
+static led_pm _led_pm = {.users=0};
+
+#ifdef LED_HW_SEQ
+static led_seq _led_seq = {.playing=false, .stopping=false};
+
+static atomic_t _led_seq_published = ATOMIC_INIT(0); // Copy of hw_mask for LED_get_seq_mask
+#endif
+
+static led_observer _led_observer = NULL;
 
-static blink_thread _led_blink_thread = {.led_bitmask=0};
-K_THREAD_STACK_DEFINE(_led_blink_stack, LED_BLINK_STACK_SIZE);
+static led_done_callback _led_done_cb = NULL;
+
+static led_init_state _led_init_state = {.done=false};
+
+static struct k_spinlock _led_cmd_lock; // Guards the ring heads and tails, and _led_cmd_overflows
+
+static uint32_t _led_cmd_overflows = 0;
+
+static atomic_t _led_write_errors = ATOMIC_INIT(0);
+
+// Perceived brightness (0 - 100) to duty cycle in PWM_DUTY_SCALE units, gamma 2.2
+static const uint16_t _led_gamma[PWM_MAX_DUTY_CYCLE + 1] = {
+  0, 0, 2, 4, 8, 14, 21, 29, 39, 50,
+  63, 78, 94, 112, 132, 154, 177, 203, 230, 259,
+  290, 323, 358, 394, 433, 474, 516, 561, 608, 657,
+  707, 760, 815, 872, 932, 993, 1056, 1122, 1190, 1260,
+  1332, 1406, 1483, 1562, 1643, 1726, 1812, 1899, 1989, 2082,
+  2176, 2273, 2373, 2474, 2578, 2684, 2793, 2904, 3017, 3132,
+  3250, 3371, 3494, 3619, 3746, 3876, 4009, 4143, 4281, 4420,
+  4563, 4707, 4854, 5004, 5156, 5310, 5468, 5627, 5789, 5954,
+  6121, 6290, 6462, 6637, 6814, 6994, 7176, 7361, 7549, 7739,
+  7931, 8126, 8324, 8524, 8727, 8933, 9141, 9352, 9565, 9781,
+  10000,
+};
+
+// International Morse code for '!' - 'Z', one byte per character: a leading 1, then one bit
+// per symbol from the first, 1 for a dash. 0 for characters that have no code
+static const uint8_t _led_morse[] = {
+  ['!']=0b1101011, ['"']=0b1010010, ['&']=0b101000, ['\'']=0b1011110, ['(']=0b110110,
+  [')']=0b1101101, ['+']=0b101010, [',']=0b1110011, ['-']=0b1100001, ['.']=0b1010101,
+  ['/']=0b110010, ['0']=0b111111, ['1']=0b101111, ['2']=0b100111, ['3']=0b100011,
+  ['4']=0b100001, ['5']=0b100000, ['6']=0b110000, ['7']=0b111000, ['8']=0b111100,
+  ['9']=0b111110, [':']=0b1111000, [';']=0b1101010, ['=']=0b110001, ['?']=0b1001100,
+  ['@']=0b1011010, ['A']=0b101, ['B']=0b11000, ['C']=0b11010, ['D']=0b1100,
+  ['E']=0b10, ['F']=0b10010, ['G']=0b1110, ['H']=0b10000, ['I']=0b100,
+  ['J']=0b10111, ['K']=0b1101, ['L']=0b10100, ['M']=0b111, ['N']=0b110,
+  ['O']=0b1111, ['P']=0b10110, ['Q']=0b11101, ['R']=0b1010, ['S']=0b1000,
+  ['T']=0b11, ['U']=0b1001, ['V']=0b10001, ['W']=0b1011, ['X']=0b11001,
+  ['Y']=0b11011, ['Z']=0b11100,
+};
 
 /* ----------------------------------------------------------------------------
                               Private Functions
 ---------------------------------------------------------------------------- */
 /**
- * @brief Sets the LED to the given duty cycle, doesn't halt blinking
+ * @brief Checks the channels, sets up the owner and turns every LED off. Runs before any
+ *        other LED call, so it writes the channels itself
+ * 
+ * @return Error code, < 0 on failures
+ */
+static int _led_init() {
+  for (int i = 0; i < NUM_LEDS; i++) {
+    int rv = pwm_is_ready_dt(&_led_specs[i]);
+    if (rv < 0) {
+      return rv;
+    }
+  }
+
+  k_work_init_delayable(&_led_anim_timer.work, _led_anim_handler);
+
+#ifdef LED_HW_SEQ
+  // One sequence drives every channel at the driver's period, so it needs all of them on the
+  // one controller, with one period that a step is a whole number of
+  uint32_t period = _led_specs[0].period;
+
+  _led_seq.pwm = (NRF_PWM_Type *)DT_REG_ADDR(LED_SEQ_PWM_NODE);
+  _led_seq.usable = (0 != period && 0 == LED_SEQ_STEP_NS % period);
+  for (int i = 0; i < NUM_LEDS; i++) {
+    if (_led_specs[i].dev != _led_specs[0].dev || _led_specs[i].channel >= NRF_PWM_CHANNEL_COUNT
+        || _led_specs[i].period != period) {
+      _led_seq.usable = false;
+    }
+  }
+  if (_led_seq.usable) {
+    _led_seq.refresh = LED_SEQ_STEP_NS / period - 1;
+    _led_seq.period = k_ns_to_ticks_ceil64(period);
+  }
+#endif
+
+  // Sync the hardware with the cached duty cycles so commands can skip unchanged channels.
+  // Written straight to the channels, runtime PM isn't enabled yet and an LED that is off
+  // holds no reference, so there is nothing to claim or release
+  for (int i = 0; i < NUM_LEDS; i++) {
+    _leds[i].powered = false;
+    _leds[i].current_duty_cycle = 0;
+    // A full pulse is off as leds are active low
+    int rv = pwm_set_pulse_dt(&_led_specs[i], _led_specs[i].period);
+    if (rv < 0) {
+      return rv;
+    }
+    atomic_set(&_leds[i].published_duty_cycle, 0);
+  }
+
+  // Every LED is off, so enabling runtime PM suspends the controller straight away. One that
+  // doesn't support runtime PM is just left running
+  for (int i = 0; i < NUM_LEDS; i++) {
+    pm_device_runtime_enable(_led_specs[i].dev);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Inits the LEDs before main, after the PWM controllers they sit on. A failure is
+ *        kept for main's own LED_init call to report
+ * 
+ * @return Always 0
+ */
+static int _led_sys_init() {
+  LED_init();
+  return 0;
+}
+
+/**
+ * @brief Takes a runtime PM reference on the LED's PWM controller, resuming it if every
+ *        LED was idle. Does nothing if the LED already holds one
+ * 
+ * @param [in] led the LED that is about to light up or animate
+ */
+static void _led_pm_claim(led_id led) {
+  if (_leds[led].powered) {
+    return;
+  }
+
+  _leds[led].powered = true;
+  if (0 == _led_pm.users++) {
+    _led_pm.stats.resumes++;
+  }
+  pm_device_runtime_get(_led_specs[led].dev);
+}
+
+/**
+ * @brief Drops the LED's runtime PM reference once it is off and not animated. The controller
+ *        is suspended, and its pins switched to the sleep state, when the last LED lets go
+ * 
+ * @param [in] led the LED that may have gone idle
+ */
+static void _led_pm_release(led_id led) {
+  if (!_leds[led].powered || _leds[led].current_duty_cycle || (_led_anim_timer.led_bitmask & BIT(led))) {
+    return;
+  }
+
+  _leds[led].powered = false;
+  if (0 == --_led_pm.users) {
+    _led_pm.stats.suspends++;
+  }
+  pm_device_runtime_put(_led_specs[led].dev);
+}
+
+/**
+ * @brief Writes a fine grained duty cycle to the LED's PWM channel, or to its column of the
+ *        sequence while one plays
+ * 
+ * @param [in] led the LED to write
+ * @param [in] duty the duty cycle in PWM_DUTY_SCALE units
+ * 
+ * @return Error code, < 0 on failures
+ */
+static int _led_write_channel(led_id led, uint16_t duty) {
+#ifdef LED_HW_SEQ
+  if (_led_seq.playing) {
+    uint16_t value = _led_seq_value(led, duty);
+    _led_seq_fill(led, value, value, LED_SEQ_STEPS);
+    return 0;
+  }
+#endif
+
+  uint32_t period = _led_specs[led].period;
+
+  // Subtract duty cycle as leds are active low
+  int rv = pwm_set_pulse_dt(&_led_specs[led], (uint32_t)(((uint64_t)period * (PWM_DUTY_SCALE - duty)) / PWM_DUTY_SCALE));
+  if (rv < 0) {
+    // Handed to the next caller of this LED, see _led_post
+    atomic_set(&_leds[led].error, rv);
+    atomic_inc(&_led_write_errors);
+  }
+  return rv;
+}
+
+/**
+ * @brief Writes a fine grained duty cycle to the LED, resuming the controller for anything
+ *        brighter than off. Off writes to an idle LED are skipped, its channel was already
+ *        left at 0 when it was released
+ * 
+ * @param [in] led the LED to write
+ * @param [in] duty the duty cycle in PWM_DUTY_SCALE units
+ * 
+ * @return Error code, < 0 on failures
+ */
+static int _led_write(led_id led, uint16_t duty) {
+  if (duty) {
+    _led_pm_claim(led);
+  } else if (!_leds[led].powered) {
+    return 0;
+  }
+
+  int rv = _led_write_channel(led, duty);
+  atomic_set(&_leds[led].published_duty_cycle, _leds[led].current_duty_cycle);
+  if (_led_observer) {
+    _led_observer(led, _leds[led].current_duty_cycle);
+  }
+  _led_pm_release(led);
+  return rv;
+}
+
+/**
+ * @brief Sets the LED to the given duty cycle and caches it, doesn't halt blinking
  * 
  * @param [in] led the LED to set the duty cycle of
  * @param [in] duty_cycle the duty cycle to set the LED to
@@ -85,101 +504,636 @@ static int _led_pwm_preserve_blink(led_id led, uint8_t duty_cycle) {
     return -EINVAL;
   }
   uint8_t clamped_duty_cycle = PWM_MAX_DUTY_CYCLE < duty_cycle ? PWM_MAX_DUTY_CYCLE : duty_cycle;
-  uint32_t pwm_step = _leds[led]->spec.period / PWM_MAX_DUTY_CYCLE;
-  // Subtract clamped duty cycle as leds are active low
-  return pwm_set_pulse_dt(&_leds[led]->spec, pwm_step * (PWM_MAX_DUTY_CYCLE - clamped_duty_cycle));
+  _leds[led].current_duty_cycle = clamped_duty_cycle;
+  return _led_write(led, clamped_duty_cycle * (PWM_DUTY_SCALE / PWM_MAX_DUTY_CYCLE));
 }
 
 /**
- * @brief Halts blinking for the given LED
+ * @brief Sets the LED to a fractional brightness level through the given curve, caches the
+ *        nearest whole duty cycle
+ * 
+ * @param [in] led the LED to set
+ * @param [in] level Q8 brightness level, 0 - (100 << 8)
+ * @param [in] curve how the level maps onto the duty cycle
+ * 
+ * @return Error code, < 0 on failures
+ */
+static int _led_write_level(led_id led, uint16_t level, led_curve curve) {
+  uint16_t index = level >> 8;
+  uint16_t duty;
+
+  if (LED_CURVE_GAMMA == curve && index < PWM_MAX_DUTY_CYCLE) {
+    // Interpolate between table entries so slow fades don't step
+    uint16_t low = _led_gamma[index];
+    duty = low + (((_led_gamma[index + 1] - low) * (level & 0xFF)) >> 8);
+  } else if (LED_CURVE_GAMMA == curve) {
+    duty = PWM_DUTY_SCALE;
+  } else {
+    duty = ((uint32_t)level * (PWM_DUTY_SCALE / PWM_MAX_DUTY_CYCLE)) >> 8;
+  }
+
+  _leds[led].current_duty_cycle = (level + 0x80) >> 8;
+  return _led_write(led, duty);
+}
+
+/**
+ * @brief Halts blinking and fading for the given LED, the anim timer is re-armed at the end of the pass
  * 
  * @param [in] led the LED instance to halt blinking for
  */
 static void _led_halt_blink(led_id led) {
-  if (IS_INVALID_LED(led)) {
+  _led_anim_timer.led_bitmask &= ~BIT(led);
+  _led_pm_release(led);
+}
+
+/**
+ * @brief Hands the LED to the anim timer, replacing whatever it was doing before
+ * 
+ * @param [in] led the LED instance to animate
+ * @param [in] anim what the timer should do with the LED
+ * @param [in] first_update absolute uptime in kernel ticks of the first update
+ */
+static void _led_start_anim(led_id led, led_anim anim, k_ticks_t first_update) {
+  _leds[led].anim = anim;
+  _leds[led].next_update = first_update;
+  _led_pm_claim(led);
+  _led_anim_timer.led_bitmask |= BIT(led);
+}
+
+/**
+ * @brief Hands an LED whose fade or pattern has run to its end back from the anim timer and
+ *        tells the done callback
+ * 
+ * @param [in] led the LED instance that finished
+ */
+static void _led_anim_done(led_id led) {
+  _led_anim_timer.led_bitmask &= ~BIT(led);
+  _led_pm_release(led);
+  if (_led_done_cb) {
+    _led_done_cb(led);
+  }
+}
+
+/**
+ * @brief Flips the LED between off and fully on, doesn't halt blinking
+ * 
+ * @param [in] led the LED instance to toggle
+ */
+static void _led_toggle(led_id led) {
+  _led_pwm_preserve_blink(led, _leds[led].current_duty_cycle ? 0 : PWM_MAX_DUTY_CYCLE);
+}
+
+/**
+ * @brief Advances a fade by one step, stops or reverses it once the target is reached
+ * 
+ * @param [in] led the fading LED instance
+ */
+static void _led_fade_step(led_id led) {
+  led_fade *fade = &_leds[led].fade;
+
+  fade->step++;
+  int32_t delta = (int32_t)fade->to - (int32_t)fade->from;
+  _led_write_level(led, fade->from + (delta * fade->step) / fade->steps, fade->curve);
+
+  if (fade->step < fade->steps) {
     return;
+  } else if (fade->loop) {
+    uint16_t from = fade->from;
+    fade->from = fade->to;
+    fade->to = from;
+    fade->step = 0;
+  } else {
+    _led_anim_done(led);
   }
+}
+
+/**
+ * @brief Shows the pattern's current step and sets the deadline for the next one
+ * 
+ * @param [in] led the LED playing the pattern
+ * @param [in] start absolute uptime in kernel ticks the step started at
+ */
+static void _led_pattern_write(led_id led, k_ticks_t start) {
+  const led_step *step = &_leds[led].play.pattern->steps[_leds[led].play.step];
+
+  _led_pwm_preserve_blink(led, step->duty_cycle);
+  _leds[led].next_update = start + k_ms_to_ticks_ceil64(MAX(1, step->duration_ms));
+}
 
-  _led_blink_thread.led_bitmask &= ~BIT(led);
-  if (!_led_blink_thread.led_bitmask) {
-    k_thread_suspend(_led_blink_thread.id);
+/**
+ * @brief Moves a pattern on to its next step, starts over or stops after the last one.
+ *        Steps start at the previous step's deadline so a long pattern doesn't drift
+ * 
+ * @param [in] led the LED playing the pattern
+ */
+static void _led_pattern_step(led_id led) {
+  led_play *play = &_leds[led].play;
+
+  if (++play->step >= play->pattern->count) {
+    if (!play->pattern->loop) {
+      // The last step's duty cycle is kept
+      _led_anim_done(led);
+      return;
+    }
+    play->step = 0;
   }
+  _led_pattern_write(led, _leds[led].next_update);
+}
+
+#ifdef LED_HW_SEQ
+/**
+ * @brief Converts a duty cycle to a sequence value in the PWM driver's period
+ * 
+ * @param [in] led the LED the value is for
+ * @param [in] duty the duty cycle in PWM_DUTY_SCALE units
+ * 
+ * @return The compare value with the polarity flag the PWM driver would give the channel
+ */
+static uint16_t _led_seq_value(led_id led, uint16_t duty) {
+  // Subtract duty cycle as leds are active low, as _led_write_channel does
+  uint16_t compare = (uint16_t)(((uint32_t)_led_seq.top * (PWM_DUTY_SCALE - duty)) / PWM_DUTY_SCALE);
+  return compare | ((_led_specs[led].flags & PWM_POLARITY_INVERTED) ? 0 : LED_SEQ_POLARITY);
 }
 
 /**
- * @brief Handles blinking all LEDs
+ * @brief Fills the LED's column of the sequence, alternating between two values
  * 
- * @param [in] p1 Unused thread parameter 1
- * @param [in] p2 Unused thread parameter 2
- * @param [in] p2 Unused thread parameter 3
+ * @param [in] led the LED to fill in
+ * @param [in] first the value of the first half_steps steps
+ * @param [in] second the value of the next half_steps steps
+ * @param [in] half_steps steps each value is held, LED_SEQ_STEPS for a steady LED
  */
-static void _led_blink_loop(void *p1 __attribute__((unused)), void *p2 __attribute__((unused)), void *p3 __attribute__((unused))) {
-  uint16_t min_half_period = LED_COUNTER_HALF_PERIOD / LED_16HZ;
+static void _led_seq_fill(led_id led, uint16_t first, uint16_t second, uint8_t half_steps) {
+  uint32_t channel = _led_specs[led].channel;
 
-  while (1) {
-    k_msleep(min_half_period / LED_COUNTER_UNIT);
+  for (int step = 0; step < LED_SEQ_STEPS; step++) {
+    _led_seq.values[step][channel] = ((step / half_steps) & 1) ? second : first;
+  }
+}
 
-    for (int i = 0; i < NUM_LEDS; i++) {
-      if (_led_blink_thread.led_bitmask & BIT(i)) {
-        _leds[i]->blink.offset += min_half_period;
-        if (_leds[i]->blink.offset >= _leds[i]->blink.half_period){
-          _leds[i]->blink.offset = 0;
-          LED_toggle(i);
-        }
+/**
+ * @brief Hands a blink the sequence plays back to the anim timer, in the phase the sequence
+ *        has it in. Its column keeps blinking until the sequence is rebuilt or stopped
+ * 
+ * @param [in] led the LED to hand back
+ * @param [in] now the current uptime in kernel ticks
+ */
+static void _led_seq_release(led_id led, k_ticks_t now) {
+  led_blink *blink = &_leds[led].blink;
+  k_ticks_t halves = (now - _led_seq.start) / blink->half_period;
+
+  _leds[led].current_duty_cycle = (halves & 1) ? (blink->level ? 0 : PWM_MAX_DUTY_CYCLE) : blink->level;
+  _leds[led].next_update = _led_seq.start + (halves + 1) * blink->half_period;
+  atomic_set(&_leds[led].published_duty_cycle, _leds[led].current_duty_cycle);
+  _led_seq.hw_mask &= ~BIT(led);
+  atomic_set(&_led_seq_published, _led_seq.hw_mask);
+}
+
+/**
+ * @brief Keeps the PWM driver's playback registers before the sequence takes them over
+ */
+static void _led_seq_save() {
+  NRF_PWM_Type *pwm = _led_seq.pwm;
+
+  _led_seq.saved.decoder = pwm->DECODER;
+  _led_seq.saved.loop = pwm->LOOP;
+  _led_seq.saved.shorts = pwm->SHORTS;
+  for (int i = 0; i < 2; i++) {
+    _led_seq.saved.ptr[i] = pwm->SEQ[i].PTR;
+    _led_seq.saved.cnt[i] = pwm->SEQ[i].CNT;
+    _led_seq.saved.refresh[i] = pwm->SEQ[i].REFRESH;
+    _led_seq.saved.enddelay[i] = pwm->SEQ[i].ENDDELAY;
+  }
+}
+
+/**
+ * @brief Puts the PWM driver's playback registers back, once the sequence has stopped
+ */
+static void _led_seq_restore() {
+  NRF_PWM_Type *pwm = _led_seq.pwm;
+
+  pwm->DECODER = _led_seq.saved.decoder;
+  pwm->LOOP = _led_seq.saved.loop;
+  pwm->SHORTS = _led_seq.saved.shorts;
+  for (int i = 0; i < 2; i++) {
+    pwm->SEQ[i].PTR = _led_seq.saved.ptr[i];
+    pwm->SEQ[i].CNT = _led_seq.saved.cnt[i];
+    pwm->SEQ[i].REFRESH = _led_seq.saved.refresh[i];
+    pwm->SEQ[i].ENDDELAY = _led_seq.saved.enddelay[i];
+  }
+}
+
+/**
+ * @brief Hands every blink back to the anim timer and stops the sequence at the end of the
+ *        PWM period. The owner finishes the stop from a later pass, see _led_seq_stopped, so
+ *        the system workqueue never waits on the peripheral. Until then channel writes still
+ *        go to the sequence's columns
+ * 
+ * @param [in] now the current uptime in kernel ticks
+ */
+static void _led_seq_stop(k_ticks_t now) {
+  NRF_PWM_Type *pwm = _led_seq.pwm;
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    if (_led_seq.hw_mask & BIT(i)) {
+      _led_seq_release(i, now);
+    }
+  }
+
+  nrf_pwm_shorts_set(pwm, 0);
+  nrf_pwm_event_clear(pwm, NRF_PWM_EVENT_STOPPED);
+  nrf_pwm_task_trigger(pwm, NRF_PWM_TASK_STOP);
+  _led_seq.stopping = true;
+  _led_seq.stop_check = now + _led_seq.period;
+}
+
+/**
+ * @brief Finishes a stop once the controller has reported it: puts the PWM driver's registers
+ *        back, restarts the driver's own playback and writes every channel through the driver
+ *        at the level the sequence left it at. Looks again one PWM period later otherwise
+ * 
+ * @param [in] now the current uptime in kernel ticks
+ */
+static void _led_seq_stopped(k_ticks_t now) {
+  NRF_PWM_Type *pwm = _led_seq.pwm;
+
+  if (!_led_seq.stopping) {
+    return;
+  } else if (!nrf_pwm_event_check(pwm, NRF_PWM_EVENT_STOPPED)) {
+    _led_seq.stop_check = now + _led_seq.period;
+    return;
+  }
+
+  _led_seq_restore();
+  _led_seq.stopping = false;
+  _led_seq.playing = false;
+  nrf_pwm_task_trigger(pwm, NRF_PWM_TASK_SEQSTART0);
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    _led_write_channel(i, _leds[i].current_duty_cycle * (PWM_DUTY_SCALE / PWM_MAX_DUTY_CYCLE));
+  }
+  // Taken when the sequence started, the controller may suspend from here on
+  pm_device_runtime_put(_led_specs[0].dev);
+}
+
+/**
+ * @brief Plays every blink from the sequence while nothing else is animated, and hands them
+ *        back to the anim timer otherwise. A changed set of blinks rebuilds and restarts the
+ *        sequence, so blinks already on it start over from where they are. A blink from a
+ *        partial duty cycle alternates between off and fully on, as toggles do. Nothing is
+ *        started while a stop is still completing, the pass that completes it looks again
+ * 
+ * @param [in] now the current uptime in kernel ticks
+ */
+static void _led_seq_update(k_ticks_t now) {
+  uint32_t blinks = 0;
+  bool timer_only = !_led_seq.usable;
+
+  if (_led_seq.stopping) {
+    return;
+  }
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    if (!(_led_anim_timer.led_bitmask & BIT(i))) {
+      continue;
+    }
+    // Fades and patterns need the driver's PWM period, odd frequencies don't fit the sequence
+    if (LED_ANIM_BLINK != _leds[i].anim || (LED_SEQ_STEPS / 2) % _leds[i].blink.frequency) {
+      timer_only = true;
+    }
+    blinks |= BIT(i);
+  }
+  if (timer_only) {
+    blinks = 0;
+  }
+
+  // A playing sequence whose last blink was handed back still shows that blink
+  if (!blinks) {
+    if (_led_seq.playing) {
+      _led_seq_stop(now);
+    }
+    return;
+  } else if (blinks == _led_seq.hw_mask) {
+    return;
+  }
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    if (_led_seq.hw_mask & BIT(i)) {
+      _led_seq_release(i, now);
+    }
+  }
+
+  NRF_PWM_Type *pwm = _led_seq.pwm;
+  bool starting = !_led_seq.playing;
+  if (starting) {
+    // Held until the stop completes, so the driver can't suspend the controller under the sequence
+    pm_device_runtime_get(_led_specs[0].dev);
+    _led_seq_save();
+    _led_seq.top = pwm->COUNTERTOP;
+  }
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    led_blink *blink = &_leds[i].blink;
+
+    if (blinks & BIT(i)) {
+      blink->level = _leds[i].current_duty_cycle ? PWM_MAX_DUTY_CYCLE : 0;
+      _leds[i].current_duty_cycle = blink->level;
+      atomic_set(&_leds[i].published_duty_cycle, blink->level);
+      _led_seq_fill(i, _led_seq_value(i, blink->level ? PWM_DUTY_SCALE : 0),
+        _led_seq_value(i, blink->level ? 0 : PWM_DUTY_SCALE), (LED_SEQ_STEPS / 2) / blink->frequency);
+    } else {
+      uint16_t value = _led_seq_value(i, _leds[i].current_duty_cycle * (PWM_DUTY_SCALE / PWM_MAX_DUTY_CYCLE));
+      _led_seq_fill(i, value, value, LED_SEQ_STEPS);
+    }
+  }
+
+  if (starting) {
+    const nrf_pwm_sequence_t seq = {
+      .values.p_raw = &_led_seq.values[0][0],
+      .length = LED_SEQ_STEPS * NRF_PWM_CHANNEL_COUNT,
+      .repeats = _led_seq.refresh,
+      .end_delay = 0,
+    };
+
+    // PRESCALER and COUNTERTOP are left as the driver set them, steady channels keep its period
+    nrf_pwm_decoder_set(pwm, NRF_PWM_LOAD_INDIVIDUAL, NRF_PWM_STEP_AUTO);
+    // Both sequences play the same steps, the short starts the pair over for ever
+    nrf_pwm_sequence_set(pwm, 0, &seq);
+    nrf_pwm_sequence_set(pwm, 1, &seq);
+    nrf_pwm_loop_set(pwm, 1);
+    nrf_pwm_shorts_set(pwm, NRF_PWM_SHORT_LOOPSDONE_SEQSTART0_MASK);
+    _led_seq.playing = true;
+  }
+  nrf_pwm_task_trigger(pwm, NRF_PWM_TASK_SEQSTART0);
+  _led_seq.start = now;
+  _led_seq.hw_mask = blinks;
+  atomic_set(&_led_seq_published, blinks);
+}
+#endif
+
+/**
+ * @brief Carries out a command taken from the LED's command ring
+ * 
+ * @param [in] led the LED the command was posted for
+ * @param [in] cmd the command
+ */
+static void _led_apply(led_id led, const led_cmd *cmd) {
+  led_fade *fade = &_leds[led].fade;
+
+#ifdef LED_HW_SEQ
+  // Whatever the command does starts from what the sequence is showing right now
+  if (_led_seq.hw_mask & BIT(led)) {
+    _led_seq_release(led, k_uptime_ticks());
+  }
+#endif
+
+  switch (cmd->type) {
+    case LED_CMD_PWM:
+      _led_halt_blink(led);
+      // Unchanged channels are skipped so a frame only writes the LEDs that differ
+      if (cmd->a != _leds[led].current_duty_cycle) {
+        _led_pwm_preserve_blink(led, cmd->a);
       }
+      break;
+    case LED_CMD_TOGGLE:
+      _led_toggle(led);
+      break;
+    case LED_CMD_BLINK:
+      _leds[led].blink.half_period = k_us_to_ticks_near64(LED_HALF_SECOND_US / cmd->a);
+      _leds[led].blink.frequency = cmd->a;
+      _led_start_anim(led, LED_ANIM_BLINK, k_uptime_ticks() + _leds[led].blink.half_period);
+      break;
+    case LED_CMD_FADE:
+      fade->from = LED_LEVEL(_leds[led].current_duty_cycle);
+      fade->to = LED_LEVEL(cmd->a);
+      fade->step = 0;
+      fade->steps = cmd->steps;
+      fade->curve = cmd->curve;
+      fade->loop = false;
+      _led_start_anim(led, LED_ANIM_FADE, k_uptime_ticks() + k_ms_to_ticks_ceil64(LED_FADE_STEP_MS));
+      break;
+    case LED_CMD_BREATHE:
+      fade->from = LED_LEVEL(cmd->a);
+      fade->to = LED_LEVEL(cmd->b);
+      fade->step = 0;
+      fade->steps = cmd->steps;
+      fade->curve = cmd->curve;
+      fade->loop = true;
+      _led_write_level(led, fade->from, cmd->curve);
+      _led_start_anim(led, LED_ANIM_FADE, k_uptime_ticks() + k_ms_to_ticks_ceil64(LED_FADE_STEP_MS));
+      break;
+    case LED_CMD_PLAY:
+      _leds[led].play.pattern = cmd->pattern;
+      _leds[led].play.step = 0;
+      _led_start_anim(led, LED_ANIM_PATTERN, 0);
+      _led_pattern_write(led, k_uptime_ticks());
+      break;
+    default:
+      break;
+  }
+}
+
+/**
+ * @brief Arms the anim timer for the earliest update of all LEDs it animates, or for the next
+ *        look at a stopping sequence, stops it if there is neither. Blinks played by the
+ *        sequence need no updates
+ */
+static void _led_anim_schedule() {
+  uint32_t timed = _led_anim_timer.led_bitmask & ~LED_SEQ_MASK;
+  k_ticks_t next = INT64_MAX;
+
+#ifdef LED_HW_SEQ
+  if (_led_seq.stopping) {
+    next = _led_seq.stop_check;
+  }
+#endif
+  for (int i = 0; i < NUM_LEDS; i++) {
+    if ((timed & BIT(i)) && _leds[i].next_update < next) {
+      next = _leds[i].next_update;
     }
   }
+
+  if (INT64_MAX == next) {
+    k_work_cancel_delayable(&_led_anim_timer.work);
+    return;
+  }
+  k_work_reschedule(&_led_anim_timer.work, K_TIMEOUT_ABS_TICKS(next));
+}
+
+/**
+ * @brief The LED owner. Applies every posted command, then advances every blink, fade and pattern
+ *        whose deadline has passed and re-arms for the next one. The system workqueue is
+ *        cooperative, so the commands of one pass reach the PWM driver back to back, one
+ *        write per channel. Deadlines advance by exactly one period so edges don't accumulate
+ *        scheduling jitter
+ * 
+ * @param [in] work Unused, the anim timer's work item
+ */
+static void _led_anim_handler(struct k_work *work __attribute__((unused))) {
+  k_ticks_t now = k_uptime_ticks();
+  uint8_t heads[NUM_LEDS];
+
+#ifdef LED_HW_SEQ
+  // Before the commands, so they go straight to the driver once the controller is back
+  _led_seq_stopped(now);
+#endif
+
+  // One snapshot of every ring, so a frame committed meanwhile is applied whole in the next pass
+  K_SPINLOCK(&_led_cmd_lock) {
+    for (int i = 0; i < NUM_LEDS; i++) {
+      heads[i] = _leds[i].ring.head;
+    }
+  }
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    led_cmd_ring *ring = &_leds[i].ring;
+    uint8_t tail = ring->tail;
+
+    for (; tail != heads[i]; tail++) {
+      _led_apply(i, &ring->cmds[tail % LED_CMD_QUEUE_SIZE]);
+    }
+    K_SPINLOCK(&_led_cmd_lock) {
+      ring->tail = tail;
+    }
+  }
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    if (!((_led_anim_timer.led_bitmask & ~LED_SEQ_MASK) & BIT(i)) || _leds[i].next_update > now) {
+      continue;
+    }
+
+    if (LED_ANIM_PATTERN == _leds[i].anim) {
+      // Every step has its own length, so the step sets its own deadline
+      _led_pattern_step(i);
+      continue;
+    }
+
+    k_ticks_t period;
+    if (LED_ANIM_BLINK == _leds[i].anim) {
+      _led_toggle(i);
+      period = _leds[i].blink.half_period;
+    } else {
+      _led_fade_step(i);
+      period = k_ms_to_ticks_ceil64(LED_FADE_STEP_MS);
+    }
+
+    do {
+      _leds[i].next_update += period;
+    } while (_leds[i].next_update <= now);
+  }
+
+#ifdef LED_HW_SEQ
+  _led_seq_update(k_uptime_ticks());
+#endif
+
+  _led_anim_schedule();
+
+  // A command posted during this pass may have had its wakeup replaced by the line above
+  bool pending = false;
+  K_SPINLOCK(&_led_cmd_lock) {
+    for (int i = 0; i < NUM_LEDS; i++) {
+      pending |= (_leds[i].ring.head != _leds[i].ring.tail);
+    }
+  }
+  if (pending) {
+    k_work_reschedule(&_led_anim_timer.work, K_NO_WAIT);
+  }
+}
+
+/**
+ * @brief Adds a command to the LED's ring. Call with _led_cmd_lock held
+ * 
+ * @param [in] led the LED to command
+ * @param [in] cmd the command
+ * 
+ * @return false if the ring is full, the command is dropped and counted
+ */
+static bool _led_ring_push(led_id led, const led_cmd *cmd) {
+  led_cmd_ring *ring = &_leds[led].ring;
+
+  if ((uint8_t)(ring->head - ring->tail) >= LED_CMD_QUEUE_SIZE) {
+    _led_cmd_overflows++;
+    return false;
+  }
+  ring->cmds[ring->head % LED_CMD_QUEUE_SIZE] = *cmd;
+  ring->head++;
+  return true;
+}
+
+/**
+ * @brief Queues a command behind the ones the owner hasn't picked up yet and wakes the owner.
+ *        Safe from any thread or ISR, never waits on the owner. The owner runs later, so a
+ *        PWM write that failed is returned by the next call for the same LED
+ * 
+ * @param [in] led the LED to command
+ * @param [in] cmd the command
+ * 
+ * @return Error code, < 0 on failures. -ENOBUFS if the LED's ring is full
+ */
+static int _led_post(led_id led, led_cmd cmd) {
+  bool queued;
+
+  if (IS_INVALID_LED(led)) {
+    return -EINVAL;
+  }
+
+  K_SPINLOCK(&_led_cmd_lock) {
+    queued = _led_ring_push(led, &cmd);
+  }
+  if (!queued) {
+    return -ENOBUFS;
+  }
+
+  k_work_reschedule(&_led_anim_timer.work, K_NO_WAIT);
+  return (int)atomic_clear(&_leds[led].error);
 }
 
 /* ----------------------------------------------------------------------------
                               Public Functions
 ---------------------------------------------------------------------------- */
 /**
- * @brief Inits all LEDs
+ * @brief Inits all LEDs. Already run from SYS_INIT before main, calling it again only
+ *        returns the result of that first run
  * 
  * @return Error code, < 0 on failures
  */
 int LED_init() {
-  for (int i = 0; i < NUM_LEDS; i++) {
-    int rv = pwm_is_ready_dt(&_leds[i]->spec);
-    if (rv < 0) {
-      return rv;
-    }
+  if (_led_init_state.done) {
+    return _led_init_state.rv;
   }
 
-  _led_blink_thread.id = k_thread_create(
-    &_led_blink_thread.thread,
-    _led_blink_stack,
-    K_THREAD_STACK_SIZEOF(_led_blink_stack),
-    _led_blink_loop,
-    NULL, NULL, NULL,
-    LED_BLINK_PRIORITY,
-    0,
-    K_NO_WAIT
-  );
-  k_thread_suspend(_led_blink_thread.id);
-  
-  return 0;
+  _led_init_state.start = k_cycle_get_32();
+  _led_init_state.rv = _led_init();
+  _led_init_state.end = k_cycle_get_32();
+  _led_init_state.done = true;
+  return _led_init_state.rv;
+}
+
+/**
+ * @brief Gets when the first LED_init ran, for boot profiling
+ * 
+ * @param [out] start k_cycle_get_32() when it started
+ * @param [out] end k_cycle_get_32() when it returned
+ * 
+ * @return true if LED_init has run
+ */
+bool LED_get_init_cycles(uint32_t *start, uint32_t *end) {
+  *start = _led_init_state.start;
+  *end = _led_init_state.end;
+  return _led_init_state.done;
 }
 
 /**
- * @brief Toggle specified LED
+ * @brief Toggle specified LED, doesn't halt blinking. Every toggle is applied, two toggles
+ *        posted before the owner runs leave the LED as it was
  * 
  * @param [in] led The LED instance to toggle
  * 
  * @return Error code, < 0 on failures
  */
 int LED_toggle(led_id led) {
-  if (IS_INVALID_LED(led)) {
-    return -EINVAL;
-  } else {
-    if (0 == _leds[led]->current_duty_cycle) {
-      _leds[led]->current_duty_cycle = PWM_MAX_DUTY_CYCLE;
-    } else {
-      _leds[led]->current_duty_cycle = 0;
-    }
-    return _led_pwm_preserve_blink(led, _leds[led]->current_duty_cycle);
-  }
+  led_cmd cmd = {.type=LED_CMD_TOGGLE};
+  return _led_post(led, cmd);
 }
 
 /**
@@ -191,18 +1145,13 @@ int LED_toggle(led_id led) {
  * @return Error code, < 0 on failures
  */
 int LED_set(led_id led, led_state new_state) {
-  if (IS_INVALID_LED(led)) {
-    return -EINVAL;
-  }
-
-  _led_halt_blink(led);
-
-  _leds[led]->current_duty_cycle = (0 == new_state) ? 0 : PWM_MAX_DUTY_CYCLE;
-  return LED_pwm(led, _leds[led]->current_duty_cycle);
+  return LED_pwm(led, (0 == new_state) ? 0 : PWM_MAX_DUTY_CYCLE);
 }
 
 /**
- * @brief Set specified LED to given pwm duty cycle
+ * @brief Set specified LED to given pwm duty cycle, halts blinking and fading. The owner
+ *        applies it shortly after, a PWM write that failed is returned by the next call
+ *        for this LED
  * 
  * @param [in] led The LED instance to set the pwm duty cycle of
  * @param [in] duty_cycle The duty cycle to set the LED to, expects 0 - 100 only
@@ -210,13 +1159,22 @@ int LED_set(led_id led, led_state new_state) {
  * @return Error code, < 0 on failures
  */
 int LED_pwm(led_id led, uint8_t duty_cycle) {
+  led_cmd cmd = {.type=LED_CMD_PWM, .a=MIN(duty_cycle, PWM_MAX_DUTY_CYCLE)};
+  return _led_post(led, cmd);
+}
+
+/**
+ * @brief Gets the duty cycle the LED was last written with, including blink and fade steps
+ * 
+ * @param [in] led The LED instance to read
+ * 
+ * @return The duty cycle, 0 - 100, 0 for an invalid LED
+ */
+uint8_t LED_get_pwm(led_id led) {
   if (IS_INVALID_LED(led)) {
-    return -EINVAL;
+    return 0;
   }
-
-  _led_halt_blink(led);
-
-  return _led_pwm_preserve_blink(led, duty_cycle);
+  return (uint8_t)atomic_get(&_leds[led].published_duty_cycle);
 }
 
 /**
@@ -226,18 +1184,277 @@ int LED_pwm(led_id led, uint8_t duty_cycle) {
  * @param [in] frequency The frequency to blink the led at
  */
 void LED_blink(led_id led, led_frequency frequency) {
-  if (IS_INVALID_LED(led)) {
-    return;
-  } else if (frequency > LED_16HZ || frequency <= 0) {
+  if (frequency > LED_16HZ || frequency <= 0) {
     return;
   }
 
-  _leds[led]->blink.half_period = LED_COUNTER_HALF_PERIOD / frequency;
-  _leds[led]->blink.offset = 0;
+  led_cmd cmd = {.type=LED_CMD_BLINK, .a=frequency};
+  _led_post(led, cmd);
+}
+
+/**
+ * @brief Stages duty cycles for a group of LEDs, nothing changes until LED_frame_commit is called.
+ *        Staging the same LED twice before a commit keeps the latest duty cycle. The frame is
+ *        built by the caller, only one thread should build frames
+ * 
+ * @param [in] mask Bitmask of the LEDs to stage, BIT(LEDx)
+ * @param [in] duty Duty cycle for every LED, only entries selected by mask are used
+ * 
+ * @return Error code, < 0 on failures
+ */
+int LED_frame_set(uint32_t mask, const uint8_t duty[NUM_LEDS]) {
+  if (mask & ~BIT_MASK(NUM_LEDS)) {
+    return -EINVAL;
+  }
+
+  for (int i = 0; i < NUM_LEDS; i++) {
+    if (mask & BIT(i)) {
+      _led_frame.duty[i] = PWM_MAX_DUTY_CYCLE < duty[i] ? PWM_MAX_DUTY_CYCLE : duty[i];
+    }
+  }
+  _led_frame.mask |= mask;
+
+  return 0;
+}
+
+/**
+ * @brief Queues every staged LED under one lock and wakes the owner once, halting blinking for
+ *        them. The owner snapshots the rings under the same lock, so the whole frame is
+ *        applied in one pass with no other command in between. This only batches the writes:
+ *        every channel is still its own pwm_set_pulse_dt, and the PWM driver applies each one
+ *        on its own (and stops or restarts playback at 0% and 100%), so the channels may
+ *        change one or more PWM periods apart. Channels whose cached duty cycle already
+ *        matches are skipped
+ * 
+ * @return Error code, < 0 on failures. -ENOBUFS if a staged LED's ring is full, nothing is
+ *         queued then and the frame stays staged
+ */
+int LED_frame_commit() {
+  uint32_t mask = _led_frame.mask;
+  int rv = 0;
+
+  if (!mask) {
+    return 0;
+  }
+
+  K_SPINLOCK(&_led_cmd_lock) {
+    for (int i = 0; i < NUM_LEDS; i++) {
+      if ((mask & BIT(i)) && (uint8_t)(_leds[i].ring.head - _leds[i].ring.tail) >= LED_CMD_QUEUE_SIZE) {
+        rv = -ENOBUFS;
+      }
+    }
+    if (rv < 0) {
+      _led_cmd_overflows++;
+      K_SPINLOCK_BREAK;
+    }
 
-  if (!_led_blink_thread.led_bitmask) {
-    k_thread_resume(_led_blink_thread.id);
+    for (int i = 0; i < NUM_LEDS; i++) {
+      if (mask & BIT(i)) {
+        led_cmd cmd = {.type=LED_CMD_PWM, .a=_led_frame.duty[i]};
+        _led_ring_push(i, &cmd);
+      }
+    }
   }
+  if (rv < 0) {
+    return rv;
+  }
+
+  _led_frame.mask = 0;
+  k_work_reschedule(&_led_anim_timer.work, K_NO_WAIT);
 
-  _led_blink_thread.led_bitmask |= BIT(led);
+  for (int i = 0; i < NUM_LEDS && 0 == rv; i++) {
+    if (mask & BIT(i)) {
+      rv = (int)atomic_clear(&_leds[i].error);
+    }
+  }
+  return rv;
 }
+
+/**
+ * @brief Fades the given LED from its current duty cycle to a target in the background.
+ *        Returns immediately, the fade is stepped once per PWM period by the anim timer
+ * 
+ * @param [in] led The LED instance to fade
+ * @param [in] target The duty cycle to end on, expects 0 - 100 only
+ * @param [in] duration_ms How long the fade should take
+ * @param [in] curve How brightness maps onto the duty cycle along the way
+ * 
+ * @return Error code, < 0 on failures
+ */
+int LED_fade(led_id led, uint8_t target, uint16_t duration_ms, led_curve curve) {
+  led_cmd cmd = {
+    .type=LED_CMD_FADE,
+    .curve=curve,
+    .a=MIN(target, PWM_MAX_DUTY_CYCLE),
+    .steps=MAX(1, duration_ms / LED_FADE_STEP_MS),
+  };
+  return _led_post(led, cmd);
+}
+
+/**
+ * @brief Fades the given LED up and down between two duty cycles until it is set to something else
+ * 
+ * @param [in] led The LED instance to breathe
+ * @param [in] min The dimmest duty cycle, expects 0 - 100 only
+ * @param [in] max The brightest duty cycle, expects 0 - 100 only
+ * @param [in] period_ms Time for one full dim -> bright -> dim cycle
+ * @param [in] curve How brightness maps onto the duty cycle along the way
+ * 
+ * @return Error code, < 0 on failures
+ */
+int LED_breathe(led_id led, uint8_t min, uint8_t max, uint16_t period_ms, led_curve curve) {
+  led_cmd cmd = {
+    .type=LED_CMD_BREATHE,
+    .curve=curve,
+    .a=MIN(min, PWM_MAX_DUTY_CYCLE),
+    .b=MIN(max, PWM_MAX_DUTY_CYCLE),
+    .steps=MAX(1, period_ms / 2 / LED_FADE_STEP_MS),
+  };
+  return _led_post(led, cmd);
+}
+
+/**
+ * @brief Plays a sequence of duty cycles with their own durations in the background, replacing
+ *        whatever the LED was doing. Patterns are stepped by the same timer as blinks and fades,
+ *        so any number of LEDs can play at once for the cost of one deadline each
+ * 
+ * @param [in] led The LED instance to play the pattern on
+ * @param [in] pattern The steps to play, must stay valid until the LED is given something else
+ * 
+ * @return Error code, < 0 on failures
+ */
+int LED_play(led_id led, const led_pattern *pattern) {
+  if (IS_INVALID_LED(led) || !pattern || !pattern->steps || 0 == pattern->count) {
+    return -EINVAL;
+  }
+
+  led_cmd cmd = {.type=LED_CMD_PLAY, .pattern=pattern};
+  return _led_post(led, cmd);
+}
+
+/**
+ * @brief Encodes text as Morse code steps for LED_play. A dot is on for one unit, a dash for
+ *        three, with one unit off between symbols, three between characters and seven between
+ *        words. Letters are case insensitive and characters without a code are skipped. Text
+ *        that doesn't fit is cut at a character boundary
+ * 
+ * @param [in] text The text to encode
+ * @param [in] unit_ms Length of a dot, up to 9362 so a word gap fits in a step
+ * @param [out] steps Filled with the encoded steps, the last one is the gap after the last character
+ * @param [in] max_steps Size of steps
+ * 
+ * @return Number of steps written
+ */
+int LED_morse(const char *text, uint16_t unit_ms, led_step *steps, uint16_t max_steps) {
+  uint16_t count = 0;
+
+  for (; *text; text++) {
+    uint8_t c = (*text >= 'a' && *text <= 'z') ? *text - 'a' + 'A' : *text;
+    uint8_t code = (c < ARRAY_SIZE(_led_morse)) ? _led_morse[c] : 0;
+
+    if (' ' == c && count) {
+      steps[count - 1].duration_ms = LED_MORSE_WORD_GAP * unit_ms;
+      continue;
+    } else if (!code) {
+      continue;
+    }
+
+    uint8_t symbols = find_msb_set(code) - 1;
+    if (count + 2 * symbols > max_steps) {
+      break;
+    }
+
+    for (int bit = symbols - 1; bit >= 0; bit--) {
+      steps[count++] = (led_step){.duration_ms=((code & BIT(bit)) ? LED_MORSE_DASH : 1) * unit_ms, .duty_cycle=LED_MAX_DUTY_CYCLE};
+      steps[count++] = (led_step){.duration_ms=unit_ms, .duty_cycle=0};
+    }
+    steps[count - 1].duration_ms = LED_MORSE_CHAR_GAP * unit_ms;
+  }
+
+  return count;
+}
+
+/**
+ * @brief Gets how many times the PWM controller was suspended and resumed by the LED driver
+ * 
+ * @param [out] stats Filled with the current counters
+ */
+void LED_get_pm_stats(led_pm_stats *stats) {
+  *stats = _led_pm.stats;
+}
+
+/**
+ * @brief Gets how many commands were dropped on a full ring and how many PWM writes failed
+ * 
+ * @param [out] stats Filled with the current counters
+ */
+void LED_get_cmd_stats(led_cmd_stats *stats) {
+  K_SPINLOCK(&_led_cmd_lock) {
+    stats->overflows = _led_cmd_overflows;
+  }
+  stats->write_errors = (uint32_t)atomic_get(&_led_write_errors);
+}
+
+/**
+ * @brief Gets the LEDs whose blink the PWM sequence plays, see CONFIG_LED_BLINK_HW_SEQ
+ * 
+ * @return BIT(LEDx) of every LED blinking from the sequence, 0 while the anim timer blinks them all
+ */
+uint32_t LED_get_seq_mask() {
+#ifdef LED_HW_SEQ
+  return (uint32_t)atomic_get(&_led_seq_published);
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Registers a function to be told about every duty cycle written to an LED, e.g. to
+ *        log an LED timeline. It runs from the LED owner on the system workqueue, pass NULL
+ *        to unregister
+ * 
+ * @param [in] cb The function to call with the LED and its new duty cycle, 0 - 100
+ */
+void LED_set_observer(led_observer cb) {
+  _led_observer = cb;
+}
+
+/**
+ * @brief Registers a function to be told when a fade or a pattern that doesn't loop has run
+ *        to its end. Not called for one replaced by another command. It runs from the LED
+ *        owner on the system workqueue, pass NULL to unregister
+ * 
+ * @param [in] cb The function to call with the LED that finished
+ */
+void LED_set_done_callback(led_done_callback cb) {
+  _led_done_cb = cb;
+}
+
+SYS_INIT(_led_sys_init, APPLICATION, CONFIG_LED_INIT_PRIORITY);
+
+/* ----------------------------------------------------------------------------
+                                Shell Commands
+---------------------------------------------------------------------------- */
+#ifdef CONFIG_SHELL
+
+static int _led_cmd_stats(const struct shell *sh, size_t argc, char **argv) {
+  led_pm_stats pm;
+  led_cmd_stats cmds;
+
+  LED_get_pm_stats(&pm);
+  LED_get_cmd_stats(&cmds);
+  for (int i = 0; i < NUM_LEDS; i++) {
+    shell_print(sh, "LED%d: %u%%", i, LED_get_pwm(i));
+  }
+  shell_print(sh, "pm: %" PRIu32 " suspends, %" PRIu32 " resumes", pm.suspends, pm.resumes);
+  shell_print(sh, "commands: %" PRIu32 " overflows, %" PRIu32 " write errors", cmds.overflows, cmds.write_errors);
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(_led_cmds,
+  SHELL_CMD(stats, NULL, "Show the duty cycles, runtime PM and command counters", _led_cmd_stats),
+  SHELL_SUBCMD_SET_END
+);
+SHELL_CMD_REGISTER(led, &_led_cmds, "LED driver state", NULL);
+
+#endif // CONFIG_SHELL